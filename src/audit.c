@@ -0,0 +1,418 @@
+#include "numtheory.h"
+#include "rsa.h"
+#include "randstate.h"
+#include "keyring.h"
+#include "pool.h"
+#include "walk.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPTIONS      "m:r:k:t:vh"
+#define VERBOSE      true
+#define BASE10       10
+#define BATCH_E_BITS 256 // Shortest shared exponent worth verifying a group of keys in one test
+
+typedef struct {
+    char *source; // The file, or keyring:user, the key came from
+    char *user;
+    mpz_t n, e, s, m;
+    bool readable; // Whether the key could be parsed at all
+    bool valid;
+} Entry;
+
+typedef struct {
+    Entry **keys; // Keys that share one (n, e)
+    uint64_t count;
+} Group;
+
+typedef struct {
+    Entry *entries;
+    uint64_t count, capacity;
+} Audit;
+
+void help_message(char *error);
+bool add_entry(Audit *a, char *source, mpz_t n, mpz_t e, mpz_t s, char *user, bool readable);
+bool add_file(Audit *a, char *path);
+bool add_list(Audit *a, char *list);
+bool add_directory(Audit *a, char *dir);
+bool add_keyring(Audit *a, char *path);
+uint64_t run_audit(Audit *a, uint64_t threads, bool verbose);
+void delete_audit(Audit *a);
+bool check_optarg(char *optarg);
+bool valid_input(char *optarg, uint64_t *variable);
+
+
+int main(int argc, char **argv) {
+    int8_t opt = 0;
+    bool verbose = false, loaded = true;
+    uint64_t threads = sysconf(_SC_NPROCESSORS_ONLN);
+    Audit audit = { NULL, 0, 0 };
+    // Checks all flags
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'v': verbose = VERBOSE; break; // Stats
+        case 'm': // List of public key files
+            if (!check_optarg(optarg)) {
+                delete_audit(&audit);
+                return EXIT_FAILURE;
+            }
+            loaded = add_list(&audit, optarg) && loaded;
+            break;
+        case 'r': // Directory of public key files
+            if (!check_optarg(optarg)) {
+                delete_audit(&audit);
+                return EXIT_FAILURE;
+            }
+            loaded = add_directory(&audit, optarg) && loaded;
+            break;
+        case 'k': // Keyring
+            if (!check_optarg(optarg)) {
+                delete_audit(&audit);
+                return EXIT_FAILURE;
+            }
+            loaded = add_keyring(&audit, optarg) && loaded;
+            break;
+        case 't': // Worker threads
+            if (!check_optarg(optarg) || !valid_input(optarg, &threads)) {
+                delete_audit(&audit);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h': help_message(""); delete_audit(&audit); return EXIT_SUCCESS;
+        default: help_message("Invalid flag.\n"); delete_audit(&audit); return EXIT_FAILURE;
+        }
+    }
+    for (int i = optind; i < argc; i++) { // Remaining arguments are public key files
+        loaded = add_file(&audit, argv[i]) && loaded;
+    }
+
+    if (audit.count == 0) {
+        help_message(loaded ? "No public keys to audit.\n" : "");
+        delete_audit(&audit);
+        return EXIT_FAILURE;
+    }
+    if (!randstate_init_os()) { // Weights for verifying groups of keys
+        fprintf(stderr, "Unable to seed the random state.\n");
+        delete_audit(&audit);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t failures = run_audit(&audit, threads, verbose);
+    if (verbose || failures) {
+        fprintf(failures ? stderr : stdout, "%lu of %lu signatures failed.\n", failures, audit.count);
+    }
+    randstate_clear();
+    delete_audit(&audit);
+    return failures || !loaded ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+//
+// Adds a key to the audit.
+//
+// a: the audit
+// source: where the key came from
+// n: the public product
+// e: the public exponent
+// s: the signature of the user
+// user: the username of the user
+// readable: whether the key could be read
+//
+bool add_entry(Audit *a, char *source, mpz_t n, mpz_t e, mpz_t s, char *user, bool readable) {
+    if (a->count == a->capacity) {
+        uint64_t capacity = a->capacity ? a->capacity * 2 : 256;
+        Entry *entries = (Entry *) realloc(a->entries, capacity * sizeof(Entry));
+        if (!entries) {
+            fprintf(stderr, "Unable to allocate memory for %s.\n", source);
+            return false;
+        }
+        a->entries = entries, a->capacity = capacity;
+    }
+    Entry *entry = &a->entries[a->count];
+    entry->source = strdup(source);
+    entry->user = strdup(user);
+    if (!entry->source || !entry->user) {
+        free(entry->source), free(entry->user);
+        fprintf(stderr, "Unable to allocate memory for %s.\n", source);
+        return false;
+    }
+    mpz_init_set(entry->n, n);
+    mpz_init_set(entry->e, e);
+    mpz_init_set(entry->s, s);
+    mpz_init(entry->m);
+    // The signed message is the username read as a base 62 number
+    entry->readable = readable && mpz_sgn(n) > 0 && !mpz_set_str(entry->m, user, 62);
+    entry->valid = false;
+    a->count += 1;
+    return true;
+}
+
+//
+// Adds one public key file to the audit. A file that is not a public key is still added
+// so that it is reported as a failure.
+//
+// a: the audit
+// path: the public key file
+//
+bool add_file(Audit *a, char *path) {
+    FILE *pbfile = fopen(path, "r");
+    if (!pbfile) {
+        fprintf(stderr, "Unable to open %s.\n", path);
+    }
+    char user[USER_MAX] = "";
+    mpz_t n, e, s;
+    mpz_inits(n, e, s, NULL);
+    if (pbfile) {
+        rsa_read_pub(n, e, s, user, pbfile);
+    }
+    bool added = add_entry(a, path, n, e, s, user, pbfile && !ferror(pbfile));
+    if (pbfile) {
+        fclose(pbfile);
+    }
+    mpz_clears(n, e, s, NULL);
+    return added;
+}
+
+//
+// Adds every public key file listed in a file, one path per line. Blank lines and lines
+// starting with # are skipped.
+//
+// a: the audit
+// list: the file listing the public key files
+//
+bool add_list(Audit *a, char *list) {
+    FILE *paths = fopen(list, "r");
+    if (!paths) {
+        fprintf(stderr, "Unable to open list %s.\n", list);
+        return false;
+    }
+    char *line = NULL;
+    size_t length = 0;
+    bool ok = true;
+    while (ok && getline(&line, &length, paths) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0' && line[0] != '#') {
+            ok = add_file(a, line);
+        }
+    }
+    free(line);
+    fclose(paths);
+    return ok;
+}
+
+//
+// Adds one file found under a directory if it is a public key file.
+//
+// path: the file found
+// relative: its path below the scanned directory
+// arg: the audit
+//
+static bool add_found(char *path, char *relative, void *arg) {
+    size_t len = strlen(relative);
+    if (len > 4 && !strcmp(relative + len - 4, ".pub")) {
+        return add_file((Audit *) arg, path);
+    }
+    return true;
+}
+
+//
+// Recursively adds every file ending in .pub under a directory. Symbolic links are
+// followed to files but not to directories.
+//
+// a: the audit
+// dir: the directory to scan
+//
+bool add_directory(Audit *a, char *dir) {
+    return walk_tree(dir, add_found, a);
+}
+
+//
+// Adds every key in a keyring to the audit.
+//
+// a: the audit
+// path: the keyring file
+//
+bool add_keyring(Audit *a, char *path) {
+    Keyring *k = keyring_open(path);
+    if (!k) {
+        fprintf(stderr, "Unable to open keyring %s.\n", path);
+        return false;
+    }
+    size_t source_len = strlen(path) + USER_MAX + 1;
+    char user[USER_MAX], *source = (char *) malloc(source_len);
+    mpz_t n, e, s, d;
+    mpz_inits(n, e, s, d, NULL);
+    bool ok = source != NULL;
+    for (uint64_t cursor = 0; ok && keyring_next(k, &cursor, n, e, s, d, user);) {
+        snprintf(source, source_len, "%s:%s", path, user);
+        ok = add_entry(a, source, n, e, s, user, true);
+    }
+    mpz_clears(n, e, s, d, NULL);
+    free(source);
+    keyring_close(&k);
+    return ok;
+}
+
+//
+// Orders keys by modulus and then exponent so keys sharing both end up next to each other.
+//
+static int by_key(const void *a, const void *b) {
+    Entry *left = *(Entry **) a, *right = *(Entry **) b;
+    int order = mpz_cmp(left->n, right->n);
+    return order ? order : mpz_cmp(left->e, right->e);
+}
+
+//
+// Verifies one group of keys on a pool worker. Groups with a long shared exponent are
+// first checked in a single test, and only checked key by key if that fails.
+//
+// arg: the group to verify
+//
+static void verify_group(void *arg) {
+    Group *g = (Group *) arg;
+    Entry *first = g->keys[0];
+    if (g->count > 1 && mpz_sizeinbase(first->e, 2) >= BATCH_E_BITS) {
+        mpz_ptr *m = (mpz_ptr *) malloc(g->count * sizeof(mpz_ptr));
+        mpz_ptr *s = (mpz_ptr *) malloc(g->count * sizeof(mpz_ptr));
+        bool all = m && s;
+        for (uint64_t i = 0; all && i < g->count; i++) {
+            m[i] = g->keys[i]->m, s[i] = g->keys[i]->s;
+            all = g->keys[i]->readable;
+        }
+        all = all && rsa_verify_batch(m, s, g->count, first->e, first->n);
+        free(m), free(s);
+        if (all) {
+            for (uint64_t i = 0; i < g->count; i++) {
+                g->keys[i]->valid = true;
+            }
+            return;
+        }
+    }
+    for (uint64_t i = 0; i < g->count; i++) {
+        Entry *key = g->keys[i];
+        key->valid = key->readable && rsa_verify(key->m, key->s, key->e, key->n);
+    }
+}
+
+//
+// Verifies every key in the audit across the worker threads and reports the failures
+// in the order the keys were given. Returns the number of failures.
+//
+// a: the audit
+// threads: the number of worker threads
+// verbose: whether to report the keys that passed too
+//
+uint64_t run_audit(Audit *a, uint64_t threads, bool verbose) {
+    Entry **order = (Entry **) malloc(a->count * sizeof(Entry *));
+    Group *groups = (Group *) malloc(a->count * sizeof(Group));
+    Pool *pool = pool_create(threads ? threads : 1);
+    if (!order || !groups || !pool) {
+        fprintf(stderr, "Unable to allocate memory for the audit.\n");
+        free(order), free(groups), pool_delete(&pool);
+        return a->count;
+    }
+    for (uint64_t i = 0; i < a->count; i++) {
+        order[i] = &a->entries[i];
+    }
+    qsort(order, a->count, sizeof(Entry *), by_key);
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < a->count; i++) {
+        if (count == 0 || by_key(&order[i], groups[count - 1].keys) != 0) {
+            groups[count++] = (Group) { &order[i], 0 };
+        }
+        groups[count - 1].count += 1;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        pool_submit(pool, verify_group, &groups[i]);
+    }
+    pool_wait(pool);
+    pool_delete(&pool);
+
+    uint64_t failures = 0;
+    for (uint64_t i = 0; i < a->count; i++) {
+        Entry *key = &a->entries[i];
+        if (!key->valid) {
+            fprintf(stdout, "FAIL %s: %s\n", key->source, key->readable ? "invalid signature" : "unreadable key");
+            failures += 1;
+        } else if (verbose) {
+            fprintf(stdout, "OK   %s (%s)\n", key->source, key->user);
+        }
+    }
+    fflush(stdout);
+    free(order);
+    free(groups);
+    return failures;
+}
+
+//
+// Frees every key in the audit.
+//
+// a: the audit
+//
+void delete_audit(Audit *a) {
+    for (uint64_t i = 0; i < a->count; i++) {
+        Entry *key = &a->entries[i];
+        free(key->source);
+        free(key->user);
+        mpz_clears(key->n, key->e, key->s, key->m, NULL);
+    }
+    free(a->entries);
+    a->entries = NULL;
+    a->count = a->capacity = 0;
+    return;
+}
+
+//
+// Ensures a flag that needs an argument has an argument.
+//
+// optarg: the argument for the specified flag
+//
+bool check_optarg(char *optarg) {
+    if (!optarg) {
+        help_message("");
+        return false;
+    }
+    return true;
+}
+
+//
+// Ensures the input for certain flags are valid (no characters).
+//
+// optarg: the argument of the given flag
+// variable: the variable to store the argument into if it is valid
+//
+bool valid_input(char *optarg, uint64_t *variable) {
+    // if the argument for this flag contains a character or is less than 0, print the help message
+    char *invalid;
+    int64_t temp_input = strtoul(optarg, &invalid, BASE10);
+    if ((invalid != NULL && *invalid != '\0') || temp_input < 0) {
+        help_message("Invalid argument for specified flag.\n");
+        return false;
+    }
+    *variable = (uint64_t) temp_input;
+    return true;
+}
+
+//
+// Prints out the help message that describes how to use the program and prints an error if specified.
+//
+// error: an error to print
+//
+void help_message(char *error) {
+    if (*error != '\0') {
+        fprintf(stderr, "%s", error);
+    }
+    fprintf(stderr, "SYNOPSIS\n"
+                    "  Verifies the username signature of many public keys at once.\n\n"
+                    "USAGE\n"
+                    "  ./audit [-hv] [-t threads] [-r keydir] [-m list] [-k keyring] [pbfile ...]\n\n"
+                    "OPTIONS\n"
+                    "  -h              Display program help and usage.\n"
+                    "  -v              Also list the keys that passed.\n"
+                    "  -r keydir       Audit every .pub file under keydir.\n"
+                    "  -m list         Audit every public key file listed in list, one per line.\n"
+                    "  -k keyring      Audit every key in keyring.\n"
+                    "  -t threads      Worker threads (default: online CPUs).\n"
+                    "  pbfile          Public key files to audit.\n");
+    return;
+}
@@ -1,22 +1,37 @@
 #include "numtheory.h"
 #include "rsa.h"
 #include "randstate.h"
+#include "batch.h"
+#include "keyring.h"
 #include <unistd.h>
 #include <stdlib.h>
 
-#define OPTIONS "i:o:n:vh"
+#define OPTIONS "i:o:n:m:r:t:C:Rbvh"
 #define VERBOSE true
+#define BASE10  10
+#define EVERY   1024 // Blocks between checkpoints when only -R is given
+
+typedef struct {
+    mpz_ptr n;
+    mpz_ptr exponent;
+    Blind *blind;
+} Key;
 
 enum Files { INFILE, OUTFILE, PVFILE };
 
 void help_message(char *error, FILE **files);
+bool load_batch(Batch **batch, char *manifest, char *indir, char *outdir);
+int run_batch(Batch *batch, uint64_t threads, Key *key, bool verbose);
 void close_files(FILE **files);
 bool check_optarg(char *optarg, FILE **files);
+bool valid_input(char *optarg, uint64_t *variable, FILE **files);
 
 
 int main(int argc, char **argv) {
     int8_t opt = 0;
-    bool verbose = false;
+    bool verbose = false, resume = false, blind = false;
+    char *output = NULL, *manifest = NULL, *indir = NULL, *ring = NULL, *ringname = NULL;
+    uint64_t threads = sysconf(_SC_NPROCESSORS_ONLN), every = 0;
     FILE *files[3] = { stdin, stdout, NULL };
     // Checks all flags
     while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
@@ -36,46 +51,192 @@ int main(int argc, char **argv) {
             if (!check_optarg(optarg, files)) {
                 return EXIT_FAILURE;
             }
-            files[OUTFILE] = fopen(optarg, "w");
-            if (!files[OUTFILE]) {
-                help_message("Invalid file.\n", files);
-                return EXIT_FAILURE;
-            }
+            output = optarg; // Opened once we know whether this is a batch
             break;
         case 'n': // Private file
             if (!check_optarg(optarg, files)) {
                 return EXIT_FAILURE;
             }
             files[PVFILE] = fopen(optarg, "r");
-            if (!files[PVFILE]) {
+            if (!files[PVFILE] && !keyring_reference(optarg, &ring, &ringname)) {
                 help_message("Invalid file.\n", files);
                 return EXIT_FAILURE;
             }
             break;
+        case 'm': // Batch manifest
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            manifest = optarg;
+            break;
+        case 'r': // Batch directory
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            indir = optarg;
+            break;
+        case 't': // Batch threads
+            if (!check_optarg(optarg, files) || !valid_input(optarg, &threads, files)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'C': // Blocks between checkpoints
+            if (!check_optarg(optarg, files) || !valid_input(optarg, &every, files)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'R': resume = true; break; // Resume from the last checkpoint
+        case 'b': blind = true; break; // Blind the private key operations
         case 'h': help_message("", files); return EXIT_SUCCESS;
         default: help_message("Invalid flag.\n", files); return EXIT_FAILURE;
         }
     }
 
-    if (!files[PVFILE]) {
+    if (!files[PVFILE] && !ring) {
         files[PVFILE] = fopen("rsa.priv", "r");
     }
-    if (!files[PVFILE]) {
+    if (!files[PVFILE] && !ring) {
         help_message("Unable to open rsa.priv\n", files);
         return EXIT_FAILURE;
     }
 
+    if (blind && !randstate_init_os()) {
+        help_message("Unable to seed the random state.\n", files);
+        return EXIT_FAILURE;
+    }
+
+    Batch *batch = NULL;
+    Checkpoint *ck = NULL;
+    if ((every || resume) && (manifest || indir || files[INFILE] == stdin || !output)) {
+        help_message("Checkpoints need both -i infile and -o outfile.\n", files);
+        return EXIT_FAILURE;
+    }
+    if (manifest || indir) {
+        if (files[INFILE] != stdin || (indir && !output) || (manifest && indir)) {
+            help_message("Use either -m manifest or -r indir -o outdir for batches.\n", files);
+            return EXIT_FAILURE;
+        }
+        if (!load_batch(&batch, manifest, indir, output)) {
+            close_files(files);
+            return EXIT_FAILURE;
+        }
+    } else if (every || resume) { // A resumed output keeps the blocks already written
+        ck = checkpoint_create(output, every ? every : EVERY, resume);
+        files[OUTFILE] = ck ? fopen(output, checkpoint_saved(ck) ? "r+" : "w") : NULL;
+        if (!files[OUTFILE]) {
+            checkpoint_delete(&ck);
+            help_message("Invalid file.\n", files);
+            return EXIT_FAILURE;
+        }
+    } else if (output) {
+        files[OUTFILE] = fopen(output, "w");
+        if (!files[OUTFILE]) {
+            help_message("Invalid file.\n", files);
+            return EXIT_FAILURE;
+        }
+    }
+
     mpz_t secret, mod;
     mpz_inits(secret, mod, NULL);
-    rsa_read_priv(mod, secret, files[PVFILE]); // Read provate key and public modulus
+    if (!ring) {
+        rsa_read_priv(mod, secret, files[PVFILE]); // Read provate key and public modulus
+    } else if (!keyring_read(ring, ringname, mod, NULL, NULL, secret, NULL)) {
+        mpz_clears(secret, mod, NULL);
+        close_files(files);
+        batch_delete(&batch);
+        checkpoint_delete(&ck);
+        randstate_clear();
+        return EXIT_FAILURE;
+    }
     if (verbose) { // Verbose output
         gmp_fprintf(stdout, "n (%d bits) = %Zd\n", mpz_sizeinbase(mod, 2), mod);
         gmp_fprintf(stdout, "d (%d bits) = %Zd\n", mpz_sizeinbase(secret, 2), secret);
     }
-    rsa_decrypt_file(files[INFILE], files[OUTFILE], mod, secret);
+    Blind *pair = blind ? rsa_blind_create(secret, mod) : NULL; // Every file derives its own pair
+    if (blind && !pair) {
+        fprintf(stderr, "Unable to make a blinding pair for this key.\n");
+        mpz_clears(secret, mod, NULL);
+        close_files(files);
+        batch_delete(&batch);
+        checkpoint_delete(&ck);
+        randstate_clear();
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_SUCCESS;
+    if (batch) { // Every file shares the parsed key
+        Key key = { mod, secret, pair };
+        status = run_batch(batch, threads, &key, verbose);
+        batch_delete(&batch);
+    } else {
+        bool done = rsa_decrypt_file(files[INFILE], files[OUTFILE], mod, secret, pair, ck);
+        status = done ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    rsa_blind_delete(&pair);
+    checkpoint_delete(&ck);
     close_files(files);
+    randstate_clear();
     mpz_clears(secret, mod, NULL);
-    return EXIT_SUCCESS;
+    return status;
+}
+
+//
+// Decrypts one file of a batch.
+//
+// infile: the file to read
+// outfile: the file to write
+// arg: the shared private key
+//
+static bool decrypt_one(FILE *infile, FILE *outfile, void *arg) {
+    Key *k = (Key *) arg;
+    return rsa_decrypt_file(infile, outfile, k->n, k->exponent, k->blind, NULL);
+}
+
+//
+// Collects the file pairs of a batch from a manifest or a directory tree.
+//
+// batch: the batch to create
+// manifest: the manifest file, or NULL to scan indir
+// indir: the directory to scan
+// outdir: the directory mirroring indir
+//
+bool load_batch(Batch **batch, char *manifest, char *indir, char *outdir) {
+    *batch = batch_create();
+    if (!*batch) {
+        fprintf(stderr, "Unable to allocate the batch.\n");
+        return false;
+    }
+    bool loaded = false;
+    if (manifest) {
+        FILE *list = fopen(manifest, "r");
+        if (!list) {
+            fprintf(stderr, "Unable to open manifest %s.\n", manifest);
+        } else {
+            loaded = batch_read_manifest(*batch, list);
+            fclose(list);
+        }
+    } else {
+        loaded = batch_scan_directory(*batch, indir, outdir);
+    }
+    if (!loaded) {
+        batch_delete(batch);
+    }
+    return loaded;
+}
+
+//
+// Runs a batch across the worker threads and reports any files that failed.
+//
+// batch: the batch to run
+// threads: the number of worker threads
+// key: the shared key
+// verbose: whether to print a summary
+//
+int run_batch(Batch *batch, uint64_t threads, Key *key, bool verbose) {
+    uint64_t failures = batch_run(batch, threads, decrypt_one, key);
+    if (verbose || failures) {
+        fprintf(failures ? stderr : stdout, "%lu of %lu files failed.\n", failures, batch_size(batch));
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 //
@@ -110,6 +271,25 @@ bool check_optarg(char *optarg, FILE **files) {
     return true;
 }
 
+//
+// Ensures the input for certain flags are valid (no characters).
+//
+// optarg: the argument of the given flag
+// variable: the variable to store the argument into if it is valid
+// files: an array of file pointers
+//
+bool valid_input(char *optarg, uint64_t *variable, FILE **files) {
+    // if the argument for this flag contains a character or is less than 0, print the help message
+    char *invalid;
+    int64_t temp_input = strtoul(optarg, &invalid, BASE10);
+    if ((invalid != NULL && *invalid != '\0') || temp_input < 0) {
+        help_message("Invalid argument for specified flag.\n", files);
+        return false;
+    }
+    *variable = (uint64_t) temp_input;
+    return true;
+}
+
 //
 // Prints out the help message that describes how to use the program and prints an error if specified.
 //
@@ -125,12 +305,22 @@ void help_message(char *error, FILE **files) {
                     "  Decrypts data using RSA encryption.\n"
                     "  Encrypted data is encrypted by the encrypt program.\n\n"
                     "USAGE\n"
-                    "  ./decrypt [-hv] [-i infile] [-o outfile] [-d privkey]\n\n"
+                    "  ./decrypt [-hvb] [-i infile] [-o outfile] [-n privkey]\n"
+                    "  ./decrypt [-hvbR] [-n privkey] [-C blocks] -i infile -o outfile\n"
+                    "  ./decrypt [-hvb] [-n privkey] [-t threads] -m manifest\n"
+                    "  ./decrypt [-hvb] [-n privkey] [-t threads] -r indir -o outdir\n\n"
                     "OPTIONS\n"
                     "  -h              Display program help and usage.\n"
                     "  -v              Display verbose program output.\n"
                     "  -i infile       Input file of data to decrypt (default: stdin).\n"
                     "  -o outfile      Output file for decrypted data (default: stdout).\n"
-                    "  -n pvfile       Private key file (default: rsa.priv).\n");
+                    "  -n pvfile       Private key file or keyring:user (default: rsa.priv).\n"
+                    "  -b              Blind every block against timing and power side channels.\n"
+                    "  -m manifest     Decrypt every 'input<TAB>output' pair listed in manifest.\n"
+                    "  -r indir        Decrypt every file under indir into the same tree under outdir.\n"
+                    "  -t threads      Worker threads for batches (default: online CPUs).\n"
+                    "  -C blocks       Sync outfile and checkpoint to outfile.ckpt every so many blocks.\n"
+                    "  -R              Resume from outfile.ckpt if it exists (checkpoints every 1024\n"
+                    "                  blocks unless -C is given).\n");
     return;
 }
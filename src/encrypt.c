@@ -1,24 +1,41 @@
 #include "numtheory.h"
 #include "rsa.h"
 #include "randstate.h"
+#include "batch.h"
+#include "keyring.h"
+#include "vcache.h"
 #include <unistd.h>
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
 
-#define OPTIONS "i:o:n:vh"
+#define OPTIONS "i:o:n:c:m:r:t:C:Rfzvh"
 #define VERBOSE true
+#define BASE10  10
+#define EVERY   1024 // Blocks between checkpoints when only -R is given
+
+typedef struct {
+    mpz_ptr n;
+    mpz_ptr exponent;
+    bool compress;
+} Key;
 
 enum Files { INFILE, OUTFILE, PBFILE };
 
 void help_message(char *error, FILE **files);
+bool load_batch(Batch **batch, char *manifest, char *indir, char *outdir);
+int run_batch(Batch *batch, uint64_t threads, Key *key, bool verbose);
 void close_files(FILE **files);
 bool check_optarg(char *optarg, FILE **files);
+bool valid_input(char *optarg, uint64_t *variable, FILE **files);
 
 
 int main(int argc, char **argv) {
     int8_t opt = 0;
-    bool verbose = false;
+    bool verbose = false, force = false, compress = false, resume = false;
+    char *cache = NULL;
+    char *output = NULL, *manifest = NULL, *indir = NULL, *ring = NULL, *ringname = NULL;
+    uint64_t threads = sysconf(_SC_NPROCESSORS_ONLN), every = 0;
     FILE *files[3] = { stdin, stdout, NULL };
     // Checks all flags
     while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
@@ -38,40 +55,106 @@ int main(int argc, char **argv) {
             if (!check_optarg(optarg, files)) {
                 return EXIT_FAILURE;
             }
-            files[OUTFILE] = fopen(optarg, "w");
-            if (!files[OUTFILE]) {
-                help_message("Invalid file.\n", files);
-                return EXIT_FAILURE;
-            }
+            output = optarg; // Opened once we know whether this is a batch
             break;
         case 'n': // Public key
             if (!check_optarg(optarg, files)) {
                 return EXIT_FAILURE;
             }
             files[PBFILE] = fopen(optarg, "r");
-            if (!files[PBFILE]) {
+            if (!files[PBFILE] && !keyring_reference(optarg, &ring, &ringname)) {
                 help_message("Invalid file.\n", files);
                 return EXIT_FAILURE;
             }
             break;
+        case 'c': // Verification cache
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            cache = optarg;
+            break;
+        case 'f': force = true; break; // Always verify the signature
+        case 'z': compress = true; break; // Compress before encrypting
+        case 'm': // Batch manifest
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            manifest = optarg;
+            break;
+        case 'r': // Batch directory
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            indir = optarg;
+            break;
+        case 't': // Batch threads
+            if (!check_optarg(optarg, files) || !valid_input(optarg, &threads, files)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'C': // Blocks between checkpoints
+            if (!check_optarg(optarg, files) || !valid_input(optarg, &every, files)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'R': resume = true; break; // Resume from the last checkpoint
         case 'h': help_message("", files); return EXIT_SUCCESS;
         default: help_message("Invalid flag.\n", files); return EXIT_FAILURE;
         }
     }
 
-    if (!files[PBFILE]) {
+    if (!files[PBFILE] && !ring) {
         files[PBFILE] = fopen("rsa.pub", "r");
     }
-    if (!files[PBFILE]) {
+    if (!files[PBFILE] && !ring) {
         help_message("Unable to open rsa.pub\n", files);
         return EXIT_FAILURE;
     }
 
-    char user[1024];
+    Batch *batch = NULL;
+    Checkpoint *ck = NULL;
+    if ((every || resume) && (manifest || indir || files[INFILE] == stdin || !output)) {
+        help_message("Checkpoints need both -i infile and -o outfile.\n", files);
+        return EXIT_FAILURE;
+    }
+    if (manifest || indir) {
+        if (files[INFILE] != stdin || (indir && !output) || (manifest && indir)) {
+            help_message("Use either -m manifest or -r indir -o outdir for batches.\n", files);
+            return EXIT_FAILURE;
+        }
+        if (!load_batch(&batch, manifest, indir, output)) {
+            close_files(files);
+            return EXIT_FAILURE;
+        }
+    } else if (every || resume) { // A resumed output keeps the blocks already written
+        ck = checkpoint_create(output, every ? every : EVERY, resume);
+        files[OUTFILE] = ck ? fopen(output, checkpoint_saved(ck) ? "r+" : "w") : NULL;
+        if (!files[OUTFILE]) {
+            checkpoint_delete(&ck);
+            help_message("Invalid file.\n", files);
+            return EXIT_FAILURE;
+        }
+    } else if (output) {
+        files[OUTFILE] = fopen(output, "w");
+        if (!files[OUTFILE]) {
+            help_message("Invalid file.\n", files);
+            return EXIT_FAILURE;
+        }
+    }
+
+    char user[USER_MAX];
     mpz_t sign, exponent, mod, verify;
     mpz_inits(sign, exponent, mod, verify, NULL);
-    rsa_read_pub(mod, exponent, sign, user,
-        files[PBFILE]); // Reads in public key, exponent, and user signature/username
+    if (!ring) {
+        rsa_read_pub(mod, exponent, sign, user,
+            files[PBFILE]); // Reads in public key, exponent, and user signature/username
+    } else if (!keyring_read(ring, ringname, mod, exponent, sign, NULL, user)) {
+        mpz_clears(exponent, mod, verify, sign, NULL);
+        close_files(files);
+        batch_delete(&batch);
+        checkpoint_delete(&ck);
+        return EXIT_FAILURE;
+    }
 
     if (verbose) { // Verbose output
         gmp_fprintf(stdout, "User = %s\n", user);
@@ -83,18 +166,100 @@ int main(int argc, char **argv) {
     if (mpz_set_str(verify, user, 62)) { // Verify sender user
         mpz_clears(exponent, mod, verify, sign, NULL);
         close_files(files);
+        batch_delete(&batch);
+        checkpoint_delete(&ck);
         return EXIT_FAILURE;
     }
-    if (!rsa_verify(verify, sign, exponent, mod)) {
-        fprintf(stderr, "Invalid signature!\n");
-        mpz_clears(exponent, mod, verify, sign, NULL);
-        close_files(files);
-        return EXIT_FAILURE;
+    uint8_t fp[SHA256_BYTES];
+    rsa_fingerprint(fp, mod, exponent, sign, user);
+    if (force || !cache || !vcache_contains(cache, fp)) {
+        if (!rsa_verify(verify, sign, exponent, mod)) {
+            fprintf(stderr, "Invalid signature!\n");
+            mpz_clears(exponent, mod, verify, sign, NULL);
+            close_files(files);
+            batch_delete(&batch);
+            checkpoint_delete(&ck);
+            return EXIT_FAILURE;
+        }
+        if (cache && !vcache_record(cache, fp)) {
+            fprintf(stderr, "Unable to update verification cache %s.\n", cache);
+        }
+    } else if (verbose) {
+        fprintf(stdout, "Signature verified by cache\n");
+    }
+    int status = EXIT_SUCCESS;
+    if (batch) { // Every file shares the verified key
+        Key key = { mod, exponent, compress };
+        status = run_batch(batch, threads, &key, verbose);
+        batch_delete(&batch);
+    } else {
+        bool done = rsa_encrypt_file(files[INFILE], files[OUTFILE], mod, exponent, compress, ck);
+        status = done ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    rsa_encrypt_file(files[INFILE], files[OUTFILE], mod, exponent);
+    checkpoint_delete(&ck);
     close_files(files);
     mpz_clears(exponent, mod, verify, sign, NULL);
-    return EXIT_SUCCESS;
+    return status;
+}
+
+//
+// Encrypts one file of a batch.
+//
+// infile: the file to read
+// outfile: the file to write
+// arg: the shared public key
+//
+static bool encrypt_one(FILE *infile, FILE *outfile, void *arg) {
+    Key *k = (Key *) arg;
+    return rsa_encrypt_file(infile, outfile, k->n, k->exponent, k->compress, NULL);
+}
+
+//
+// Collects the file pairs of a batch from a manifest or a directory tree.
+//
+// batch: the batch to create
+// manifest: the manifest file, or NULL to scan indir
+// indir: the directory to scan
+// outdir: the directory mirroring indir
+//
+bool load_batch(Batch **batch, char *manifest, char *indir, char *outdir) {
+    *batch = batch_create();
+    if (!*batch) {
+        fprintf(stderr, "Unable to allocate the batch.\n");
+        return false;
+    }
+    bool loaded = false;
+    if (manifest) {
+        FILE *list = fopen(manifest, "r");
+        if (!list) {
+            fprintf(stderr, "Unable to open manifest %s.\n", manifest);
+        } else {
+            loaded = batch_read_manifest(*batch, list);
+            fclose(list);
+        }
+    } else {
+        loaded = batch_scan_directory(*batch, indir, outdir);
+    }
+    if (!loaded) {
+        batch_delete(batch);
+    }
+    return loaded;
+}
+
+//
+// Runs a batch across the worker threads and reports any files that failed.
+//
+// batch: the batch to run
+// threads: the number of worker threads
+// key: the shared key
+// verbose: whether to print a summary
+//
+int run_batch(Batch *batch, uint64_t threads, Key *key, bool verbose) {
+    uint64_t failures = batch_run(batch, threads, encrypt_one, key);
+    if (verbose || failures) {
+        fprintf(failures ? stderr : stdout, "%lu of %lu files failed.\n", failures, batch_size(batch));
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 //
@@ -129,6 +294,25 @@ bool check_optarg(char *optarg, FILE **files) {
     return true;
 }
 
+//
+// Ensures the input for certain flags are valid (no characters).
+//
+// optarg: the argument of the given flag
+// variable: the variable to store the argument into if it is valid
+// files: an array of file pointers
+//
+bool valid_input(char *optarg, uint64_t *variable, FILE **files) {
+    // if the argument for this flag contains a character or is less than 0, print the help message
+    char *invalid;
+    int64_t temp_input = strtoul(optarg, &invalid, BASE10);
+    if ((invalid != NULL && *invalid != '\0') || temp_input < 0) {
+        help_message("Invalid argument for specified flag.\n", files);
+        return false;
+    }
+    *variable = (uint64_t) temp_input;
+    return true;
+}
+
 //
 // Prints out the help message that describes how to use the program and prints an error if specified.
 //
@@ -144,12 +328,24 @@ void help_message(char *error, FILE **files) {
                     "  Encrypts data using RSA encryption.\n"
                     "  Encrypted data is decrypted by the decrypt program.\n\n"
                     "USAGE\n"
-                    "  ./encrypt [-hv] [-i infile] [-o outfile] [-n pubkey]\n\n"
+                    "  ./encrypt [-hvfz] [-i infile] [-o outfile] [-n pubkey] [-c cache]\n"
+                    "  ./encrypt [-hvfzR] [-n pubkey] [-c cache] [-C blocks] -i infile -o outfile\n"
+                    "  ./encrypt [-hvfz] [-n pubkey] [-c cache] [-t threads] -m manifest\n"
+                    "  ./encrypt [-hvfz] [-n pubkey] [-c cache] [-t threads] -r indir -o outdir\n\n"
                     "OPTIONS\n"
                     "  -h              Display program help and usage.\n"
                     "  -v              Display verbose program output.\n"
                     "  -i infile       Input file of data to encrypt (default: stdin).\n"
                     "  -o outfile      Output file for encrypted data (default: stdout).\n"
-                    "  -n pbfile       Public key file (default: rsa.pub).\n");
+                    "  -n pbfile       Public key file or keyring:user (default: rsa.pub).\n"
+                    "  -c cache        Skip signatures already verified in this cache file.\n"
+                    "  -f              Force signature verification even if cached.\n"
+                    "  -z              Compress the data before encrypting it.\n"
+                    "  -m manifest     Encrypt every 'input<TAB>output' pair listed in manifest.\n"
+                    "  -r indir        Encrypt every file under indir into the same tree under outdir.\n"
+                    "  -t threads      Worker threads for batches (default: online CPUs).\n"
+                    "  -C blocks       Sync outfile and checkpoint to outfile.ckpt every so many blocks.\n"
+                    "  -R              Resume from outfile.ckpt if it exists (checkpoints every 1024\n"
+                    "                  blocks unless -C is given).\n");
     return;
 }
@@ -1,12 +1,14 @@
 #include "numtheory.h"
 #include "rsa.h"
 #include "randstate.h"
+#include "keyring.h"
+#include "primepool.h"
+#include "tune.h"
 #include <unistd.h>
-#include <time.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 
-#define OPTIONS "b:i:n:d:s:vh"
+#define OPTIONS "b:i:n:d:s:k:f:c:p:t:Tvh"
 #define VERBOSE true
 #define BASE10  10
 #define BITS    256
@@ -22,9 +24,11 @@ bool check_optarg(char *optarg, FILE **files);
 
 int main(int argc, char **argv) {
     int8_t opt = 0;
-    bool verbose = false;
+    bool verbose = false, seeded = false, tune = false;
     FILE *files[2] = { NULL };
-    uint64_t seed = time(NULL), iterations = ITERS, bits = BITS;
+    uint64_t seed = 0, iterations = ITERS, bits = BITS, count = 0;
+    uint64_t threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char *ring = NULL, *fill = NULL, *pool = NULL;
     // Checks all flags
     while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
         switch (opt) {
@@ -63,12 +67,71 @@ int main(int argc, char **argv) {
             if (!check_optarg(optarg, files) || !valid_input(optarg, &seed, files)) {
                 return EXIT_FAILURE;
             }
+            seeded = true;
             break;
+        case 'k': // keyring
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            ring = optarg;
+            break;
+        case 'f': // prime pool to fill
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            fill = optarg;
+            break;
+        case 'c': // primes to add to the pool
+            if (!check_optarg(optarg, files) || !valid_input(optarg, &count, files)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p': // prime pool to draw from
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            pool = optarg;
+            break;
+        case 't': // threads for testing large primes
+            if (!check_optarg(optarg, files) || !valid_input(optarg, &threads, files)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T': tune = true; break; // Only time the exponentiation backends
         case 'h': help_message("", files); return EXIT_SUCCESS;
         default: help_message("Invalid flag.\n", files); return EXIT_FAILURE;
         }
     }
 
+    if (tune) { // Only rewrite the backend tuning file
+        bool saved = tune_calibrate(verbose);
+        if (!saved) {
+            fprintf(stderr, "Unable to save the tuning file (set RSA_TUNE or HOME).\n");
+        }
+        close_files(files);
+        return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (seeded) { // Deterministic keys for testing
+        randstate_init(seed);
+    } else if (!randstate_init_os()) {
+        help_message("Unable to seed the random state.\n", files);
+        return EXIT_FAILURE;
+    }
+
+    numtheory_threads(threads);
+
+    if (fill) { // Only fill the prime pool
+        uint64_t added = primepool_fill(fill, bits, count, iterations);
+        if (verbose) {
+            fprintf(stdout, "Added %lu primes to %s\n", added, fill);
+        }
+        close_files(files);
+        numtheory_threads(0);
+        randstate_clear();
+        return added == count ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     if (!files[PBFILE]) {
         files[PBFILE] = fopen("rsa.pub", "w");
     }
@@ -89,9 +152,18 @@ int main(int argc, char **argv) {
 
     mpz_t exponent, prime1, prime2, product, priv, name, sign;
     mpz_inits(exponent, prime1, prime2, product, priv, name, sign, NULL);
-    randstate_init(seed);
 
-    rsa_make_pub(prime1, prime2, product, exponent, bits, iterations); // Make public key
+    bool pooled = pool && primepool_take(pool, bits, prime1, prime2); // Reports why it failed
+    if (pooled && !rsa_make_pub_from_primes(prime1, prime2, product, exponent, bits)) {
+        fprintf(stderr, "Primes from pool %s do not make a %lu bit key.\n", pool, bits);
+        pooled = false;
+    }
+    if (!pooled) {
+        if (pool) {
+            fprintf(stderr, "Generating primes instead.\n");
+        }
+        rsa_make_pub(prime1, prime2, product, exponent, bits, iterations); // Make public key
+    }
     rsa_make_priv(priv, exponent, prime1, prime2); // Make private key
 
     mpz_set_str(name, username, 62);
@@ -100,6 +172,14 @@ int main(int argc, char **argv) {
     // Writes keys to corresponding files
     rsa_write_pub(product, exponent, sign, username, files[PBFILE]);
     rsa_write_priv(product, priv, files[PVFILE]);
+    if (ring && !keyring_add(ring, product, exponent, sign, priv, username)) {
+        fprintf(stderr, "Unable to add the key to keyring %s.\n", ring);
+        close_files(files);
+        numtheory_threads(0);
+        randstate_clear();
+        mpz_clears(exponent, prime1, prime2, product, priv, name, sign, NULL);
+        return EXIT_FAILURE;
+    }
 
     if (verbose) { // Verbose output
         gmp_fprintf(stdout, "User = %s\n", username);
@@ -111,6 +191,7 @@ int main(int argc, char **argv) {
         gmp_fprintf(stdout, "d (%d bits) = %Zd\n", mpz_sizeinbase(priv, 2), priv);
     }
     close_files(files);
+    numtheory_threads(0);
     randstate_clear();
     mpz_clears(exponent, prime1, prime2, product, priv, name, sign, NULL);
     return EXIT_SUCCESS;
@@ -179,14 +260,24 @@ void help_message(char *error, FILE **files) {
         "SYNOPSIS\n"
         "  Generates an RSA public/private key pair.\n\n"
         "USAGE\n"
-        "  ./keygen [-hv] [-i confidence] [-s seed] [-b bits] [-n pbfile] [-d pvfile]\n\n"
+        "  ./keygen [-hv] [-i confidence] [-s seed] [-b bits] [-t threads] [-n pbfile]\n"
+        "           [-d pvfile] [-k keyring] [-p pool]\n"
+        "  ./keygen [-v] [-i confidence] [-s seed] [-b bits] [-t threads] [-c count] -f pool\n"
+        "  ./keygen [-v] -T\n\n"
         "OPTIONS\n"
         "  -h              Display program help and usage.\n"
         "  -v              Display verbose program output.\n"
         "  -b bits         Minimum bits needed for the public modulus (default: 256).\n"
         "  -i confidence   Miller-Rabin iterations for testing primes (default: 50).\n"
+        "  -t threads      Threads for testing primes of 2048 bits or more (default: online CPUs).\n"
         "  -n pbfile       Public key file (default: rsa.pub).\n"
         "  -d pvfile       Private key file (default: rsa.priv).\n"
-        "  -s seed         Random seed for testing (default: seconds since the UNIX epoch)\n");
+        "  -k keyring      Also add the key pair to this keyring under $USER.\n"
+        "  -p pool         Build the key from two primes taken from a prime pool.\n"
+        "  -f pool         Fill a prime pool for keys of the given bits instead of making a key.\n"
+        "  -c count        Primes to add with -f (default: 0, keep filling until stopped).\n"
+        "  -T              Time the exponentiation backends and save the fastest to $RSA_TUNE\n"
+        "                  (default: ~/.rsa_tune) instead of making a key.\n"
+        "  -s seed         Random seed for deterministic testing (default: system entropy)\n");
     return;
 }
@@ -0,0 +1,223 @@
+#include "batch.h"
+#include "pool.h"
+#include "walk.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+    char *input;
+    char *output;
+    off_t size;
+    BatchFn fn;
+    void *arg;
+    atomic_uint_fast64_t *failures;
+} Item;
+
+struct Batch {
+    Item *items;
+    uint64_t count, capacity;
+};
+
+// Creates an empty batch of input/output file pairs.
+Batch *batch_create(void) {
+    return (Batch *) calloc(1, sizeof(Batch));
+}
+
+// Frees a batch and all of its paths.
+//
+// b: the batch to delete
+void batch_delete(Batch **b) {
+    if (!*b) {
+        return;
+    }
+    for (uint64_t i = 0; i < (*b)->count; i++) {
+        free((*b)->items[i].input);
+        free((*b)->items[i].output);
+    }
+    free((*b)->items);
+    free(*b);
+    *b = NULL;
+    return;
+}
+
+// Adds an input/output pair to the batch.
+//
+// b     : the batch
+// input : the file to read
+// output: the file to write
+bool batch_add(Batch *b, char *input, char *output) {
+    if (b->count == b->capacity) {
+        uint64_t capacity = b->capacity ? b->capacity * 2 : 64;
+        Item *items = (Item *) realloc(b->items, capacity * sizeof(Item));
+        if (!items) {
+            return false;
+        }
+        b->items = items, b->capacity = capacity;
+    }
+    struct stat info;
+    Item *item = &b->items[b->count];
+    memset(item, 0, sizeof(Item));
+    item->input = strdup(input);
+    item->output = strdup(output);
+    item->size = stat(input, &info) ? 0 : info.st_size;
+    if (!item->input || !item->output) {
+        free(item->input), free(item->output);
+        return false;
+    }
+    b->count += 1;
+    return true;
+}
+
+// Reads input/output pairs from a manifest, one pair per line separated by a tab. Paths
+// may contain spaces, so lines without a tab are rejected. Blank lines and lines starting
+// with # are skipped.
+//
+// b       : the batch
+// manifest: the manifest file
+bool batch_read_manifest(Batch *b, FILE *manifest) {
+    char *line = NULL;
+    size_t length = 0;
+    uint64_t number = 0;
+    bool ok = true;
+    while (ok && getline(&line, &length, manifest) != -1) {
+        number += 1;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        char *split = strchr(line, '\t');
+        if (!split) {
+            fprintf(stderr, "Manifest line %lu has no tab before its output file.\n", number);
+            ok = false;
+            break;
+        }
+        char *output = split + strspn(split, "\t");
+        *split = '\0';
+        ok = *output != '\0' && batch_add(b, line, output);
+        if (!ok) {
+            fprintf(stderr, "Invalid manifest line %lu.\n", number);
+        }
+    }
+    free(line);
+    return ok;
+}
+
+// The batch and output directory a directory scan adds to.
+typedef struct {
+    Batch *batch;
+    char *outdir;
+} Scan;
+
+// Adds one file found by a directory scan, mirroring its path under the output directory.
+//
+// input   : the file found
+// relative: its path below the scanned directory
+// arg     : the scan
+static bool scan_file(char *input, char *relative, void *arg) {
+    Scan *scan = (Scan *) arg;
+    size_t out_len = strlen(scan->outdir) + strlen(relative) + 2;
+    char *output = (char *) malloc(out_len);
+    if (!output) {
+        return false;
+    }
+    snprintf(output, out_len, "%s/%s", scan->outdir, relative);
+    bool ok = batch_add(scan->batch, input, output);
+    free(output);
+    return ok;
+}
+
+// Recursively adds every regular file under indir, mirroring its path under outdir.
+// Symbolic links are followed to files but not to directories.
+//
+// b     : the batch
+// indir : the directory to scan
+// outdir: the directory the outputs are written to
+bool batch_scan_directory(Batch *b, char *indir, char *outdir) {
+    Scan scan = { b, outdir };
+    return walk_tree(indir, scan_file, &scan);
+}
+
+// Returns the number of file pairs in the batch.
+//
+// b: the batch
+uint64_t batch_size(Batch *b) {
+    return b->count;
+}
+
+// Creates every missing parent directory of a path.
+//
+// path: the file whose parents are created
+static bool make_parents(char *path) {
+    for (char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        bool ok = !mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) || errno == EEXIST;
+        *slash = '/';
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Processes a single file pair on a pool worker.
+//
+// arg: the item to process
+static void run_item(void *arg) {
+    Item *item = (Item *) arg;
+    FILE *infile = fopen(item->input, "r");
+    FILE *outfile = infile && make_parents(item->output) ? fopen(item->output, "w") : NULL;
+    if (!infile || !outfile) {
+        fprintf(stderr, "Unable to open %s.\n", infile ? item->output : item->input);
+        atomic_fetch_add(item->failures, 1);
+    } else {
+        bool done = item->fn(infile, outfile, item->arg);
+        if (!done || ferror(infile) || fclose(outfile)) {
+            fprintf(stderr, "Error while processing %s.\n", item->input);
+            atomic_fetch_add(item->failures, 1);
+        }
+        outfile = NULL;
+    }
+    if (infile) {
+        fclose(infile);
+    }
+    if (outfile) {
+        fclose(outfile);
+    }
+}
+
+// Orders items from largest to smallest.
+static int by_size(const void *a, const void *b) {
+    off_t left = ((Item *) a)->size, right = ((Item *) b)->size;
+    return (left < right) - (left > right);
+}
+
+// Runs fn over every pair in the batch on a work stealing pool and returns the number of
+// pairs that failed. Files are dealt out largest first and each worker runs its own share
+// in that order, so the longest files start first and the small ones left at the end are
+// what gets stolen to keep every worker busy.
+//
+// b      : the batch
+// threads: the number of worker threads
+// fn     : the function applied to each opened pair
+// arg    : the argument passed to fn
+uint64_t batch_run(Batch *b, uint64_t threads, BatchFn fn, void *arg) {
+    atomic_uint_fast64_t failures = 0;
+    qsort(b->items, b->count, sizeof(Item), by_size);
+    Pool *pool = pool_create(threads);
+    for (uint64_t i = 0; i < b->count; i++) {
+        b->items[i].fn = fn, b->items[i].arg = arg, b->items[i].failures = &failures;
+        if (pool) {
+            pool_submit(pool, run_item, &b->items[i]);
+        } else {
+            run_item(&b->items[i]);
+        }
+    }
+    if (pool) {
+        pool_wait(pool);
+        pool_delete(&pool);
+    }
+    return atomic_load(&failures);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct Batch Batch;
+
+typedef bool (*BatchFn)(FILE *infile, FILE *outfile, void *arg);
+
+Batch *batch_create(void);
+
+void batch_delete(Batch **b);
+
+bool batch_add(Batch *b, char *input, char *output);
+
+bool batch_read_manifest(Batch *b, FILE *manifest);
+
+bool batch_scan_directory(Batch *b, char *indir, char *outdir);
+
+uint64_t batch_size(Batch *b);
+
+uint64_t batch_run(Batch *b, uint64_t threads, BatchFn fn, void *arg);
@@ -0,0 +1,234 @@
+#include "checkpoint.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define MAGIC "RSACKPT1"
+
+// A checkpoint is a text file next to the output, named "<output>.ckpt":
+//
+//   RSACKPT1
+//   <modulus in hex>
+//   <input offset> <output offset> <blocks>
+//   <carried bytes in hex, or - for none>
+//
+// The offsets mark the last block boundary at which the output was synced to disk. The
+// carried bytes are work that was read from the input but not yet written to the output:
+// the partly filled block when compressing, or the partial frame when decompressing.
+
+struct Checkpoint {
+    char *path;
+    uint64_t every, last;
+    bool saved;
+    mpz_t n;
+    off_t in_off, out_off;
+    uint64_t blocks;
+    uint8_t *carry;
+    uint64_t carry_len;
+};
+
+// Returns the value of a hex digit, or -1 if it is not one.
+//
+// ch: the character to convert
+static int hex_value(int ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    return -1;
+}
+
+// Parses a saved checkpoint. Returns false if the file is missing or malformed.
+//
+// c   : the checkpoint to fill
+// file: the checkpoint file
+static bool parse(Checkpoint *c, FILE *file) {
+    char magic[sizeof(MAGIC)];
+    long long in_off, out_off;
+    if (fscanf(file, "%8s", magic) != 1 || strcmp(magic, MAGIC) || gmp_fscanf(file, "%Zx", c->n) != 1
+        || fscanf(file, "%lld %lld %lu ", &in_off, &out_off, &c->blocks) != 3 || in_off < 0 || out_off < 0) {
+        return false;
+    }
+    c->in_off = (off_t) in_off, c->out_off = (off_t) out_off;
+    int ch = fgetc(file);
+    if (ch == '-') {
+        return true;
+    }
+    uint64_t capacity = 0, digits = 0;
+    for (; ch != EOF && ch != '\n'; ch = fgetc(file), digits++) {
+        int value = hex_value(ch);
+        if (value < 0) {
+            return false;
+        }
+        if (digits % 2 == 0) {
+            if (c->carry_len == capacity) {
+                capacity = capacity ? capacity * 2 : 4096;
+                uint8_t *carry = (uint8_t *) realloc(c->carry, capacity);
+                if (!carry) {
+                    return false;
+                }
+                c->carry = carry;
+            }
+            c->carry[c->carry_len] = (uint8_t) (value << 4);
+        } else {
+            c->carry[c->carry_len++] |= (uint8_t) value;
+        }
+    }
+    return digits > 0 && digits % 2 == 0;
+}
+
+// Creates a checkpoint for the output file, loading the saved one if resuming.
+//
+// output: the output file the checkpoint sits next to
+// every : the number of blocks between checkpoints
+// resume: whether to load a checkpoint left by an earlier run
+Checkpoint *checkpoint_create(char *output, uint64_t every, bool resume) {
+    Checkpoint *c = (Checkpoint *) calloc(1, sizeof(Checkpoint));
+    if (!c) {
+        return NULL;
+    }
+    c->path = (char *) malloc(strlen(output) + sizeof(".ckpt"));
+    if (!c->path) {
+        free(c);
+        return NULL;
+    }
+    sprintf(c->path, "%s.ckpt", output);
+    c->every = every ? every : 1;
+    mpz_init(c->n);
+    FILE *file = resume ? fopen(c->path, "r") : NULL;
+    if (file) {
+        c->saved = parse(c, file);
+        fclose(file);
+        if (!c->saved) {
+            fprintf(stderr, "Ignoring malformed checkpoint %s.\n", c->path);
+            c->carry_len = 0;
+        }
+    }
+    return c;
+}
+
+// Frees a checkpoint.
+//
+// c: the checkpoint to delete
+void checkpoint_delete(Checkpoint **c) {
+    if (!*c) {
+        return;
+    }
+    mpz_clear((*c)->n);
+    free((*c)->carry);
+    free((*c)->path);
+    free(*c);
+    *c = NULL;
+    return;
+}
+
+// Checks whether an earlier run left a checkpoint to resume from, in which case the
+// output must be opened without truncating it.
+//
+// c: the checkpoint
+bool checkpoint_saved(Checkpoint *c) {
+    return c && c->saved;
+}
+
+// Moves both files to the saved block boundary and hands back the carried bytes. The
+// output is cut at the boundary since anything past it may have been half written. Does
+// nothing and returns true if there is no checkpoint. Returns false if the checkpoint
+// belongs to another key or does not fit the files.
+//
+// c        : the checkpoint, or NULL
+// infile   : the file being read
+// outfile  : the file being written
+// n        : the public product of the key in use
+// carry    : the buffer for the carried bytes
+// capacity : the size of the carry buffer
+// carry_len: the number of carried bytes
+// blocks   : the number of blocks done before the checkpoint
+bool checkpoint_restore(Checkpoint *c, FILE *infile, FILE *outfile, mpz_t n, uint8_t *carry, uint64_t capacity,
+    uint64_t *carry_len, uint64_t *blocks) {
+    *carry_len = 0, *blocks = 0;
+    if (!c || !c->saved) {
+        return true;
+    }
+    struct stat info;
+    if (mpz_cmp(c->n, n) != 0 || c->carry_len > capacity) {
+        fprintf(stderr, "Checkpoint %s does not match this key or mode.\n", c->path);
+        return false;
+    }
+    if (fflush(outfile) || fstat(fileno(outfile), &info) || info.st_size < c->out_off
+        || ftruncate(fileno(outfile), c->out_off) || fseeko(outfile, c->out_off, SEEK_SET)
+        || fseeko(infile, c->in_off, SEEK_SET)) {
+        fprintf(stderr, "Unable to resume from checkpoint %s.\n", c->path);
+        return false;
+    }
+    if (c->carry_len) {
+        memcpy(carry, c->carry, c->carry_len);
+    }
+    *carry_len = c->carry_len, *blocks = c->blocks;
+    c->last = c->blocks;
+    return true;
+}
+
+// Records a block boundary once every so many blocks. The output is synced before the
+// checkpoint replaces the previous one by rename, so a checkpoint never points past data
+// that is on disk. Does nothing and returns true if there is no checkpoint.
+//
+// c        : the checkpoint, or NULL
+// infile   : the file being read, positioned just after the input of the blocks done
+// outfile  : the file being written, positioned just after the blocks done
+// n        : the public product of the key in use
+// carry    : the bytes read but not yet written
+// carry_len: the number of carried bytes
+// blocks   : the number of blocks done
+bool checkpoint_save(Checkpoint *c, FILE *infile, FILE *outfile, mpz_t n, uint8_t *carry, uint64_t carry_len,
+    uint64_t blocks) {
+    if (!c || blocks - c->last < c->every) {
+        return true;
+    }
+    c->last = blocks;
+    off_t in_off = ftello(infile), out_off = ftello(outfile);
+    if (in_off < 0 || out_off < 0 || fflush(outfile) || fsync(fileno(outfile))) {
+        return false;
+    }
+    char *temp = (char *) malloc(strlen(c->path) + sizeof(".tmp"));
+    if (!temp) {
+        return false;
+    }
+    sprintf(temp, "%s.tmp", c->path);
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+    bool ok = file != NULL;
+    if (ok) {
+        long long in_at = in_off, out_at = out_off;
+        ok = gmp_fprintf(file, "%s\n%Zx\n%lld %lld %lu\n", MAGIC, n, in_at, out_at, blocks) > 0;
+        for (uint64_t i = 0; ok && i < carry_len; i++) {
+            ok = fprintf(file, "%02x", carry[i]) > 0;
+        }
+        ok = ok && fprintf(file, carry_len ? "\n" : "-\n") > 0;
+        ok = !fflush(file) && !fsync(fd) && ok;
+        ok = !fclose(file) && ok && !rename(temp, c->path);
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    if (!ok) {
+        unlink(temp);
+        fprintf(stderr, "Unable to write checkpoint %s.\n", c->path);
+    }
+    free(temp);
+    return ok;
+}
+
+// Removes the checkpoint once the whole file is done.
+//
+// c: the checkpoint, or NULL
+void checkpoint_finish(Checkpoint *c) {
+    if (c) {
+        unlink(c->path);
+        c->saved = false;
+    }
+    return;
+}
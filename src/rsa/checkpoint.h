@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+typedef struct Checkpoint Checkpoint;
+
+Checkpoint *checkpoint_create(char *output, uint64_t every, bool resume);
+
+void checkpoint_delete(Checkpoint **c);
+
+bool checkpoint_saved(Checkpoint *c);
+
+bool checkpoint_restore(Checkpoint *c, FILE *infile, FILE *outfile, mpz_t n, uint8_t *carry, uint64_t capacity,
+    uint64_t *carry_len, uint64_t *blocks);
+
+bool checkpoint_save(Checkpoint *c, FILE *infile, FILE *outfile, mpz_t n, uint8_t *carry, uint64_t carry_len,
+    uint64_t blocks);
+
+void checkpoint_finish(Checkpoint *c);
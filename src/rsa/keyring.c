@@ -0,0 +1,456 @@
+#include "keyring.h"
+#include "rsa.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A keyring is a header, two open addressing hash tables of entry offsets (one keyed by
+// username, one by fingerprint) and the entries themselves. All integers are little endian.
+//
+//   header: magic[8] | count | buckets | user table offset | fingerprint table offset | 0
+//   entry : fingerprint[32] | user, n, e, s and d lengths (u32) | user | n | e | s | d
+//
+// Numbers are stored as big endian magnitudes; d has length 0 for public only entries.
+
+#define MAGIC        "RSAKEYR1"
+#define HEADER_BYTES 48
+#define FIELDS       4 // n, e, s and d
+#define ENTRY_FIXED  (SHA256_BYTES + 4 * (FIELDS + 1))
+#define MIN_BUCKETS  16
+
+struct Keyring {
+    uint8_t *map;
+    uint64_t size;
+    uint64_t count;
+    uint64_t buckets;
+    uint64_t users; // Offset of the username table
+    uint64_t prints; // Offset of the fingerprint table
+};
+
+typedef struct {
+    const uint8_t *fp;
+    const uint8_t *user;
+    uint32_t user_len;
+    const uint8_t *field[FIELDS];
+    uint32_t len[FIELDS];
+} Entry;
+
+static uint64_t get64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t) (v >> (8 * i));
+    }
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t) (v >> (8 * i));
+    }
+}
+
+// FNV-1a hash used to place entries in the tables.
+static uint64_t hash(const uint8_t *data, uint64_t len) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (uint64_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 0x100000001b3;
+    }
+    return h;
+}
+
+// Returns the number of bytes an entry takes, padded to 8 bytes.
+static uint64_t entry_size(Entry *entry) {
+    uint64_t size = ENTRY_FIXED + entry->user_len;
+    for (int i = 0; i < FIELDS; i++) {
+        size += entry->len[i];
+    }
+    return (size + 7) & ~(uint64_t) 7;
+}
+
+// Decodes the entry at an offset, checking that it lies inside the mapping.
+//
+// k     : the keyring
+// offset: the offset of the entry
+// entry : the decoded entry
+static bool read_entry(Keyring *k, uint64_t offset, Entry *entry) {
+    if (offset < HEADER_BYTES || offset > k->size || k->size - offset < ENTRY_FIXED) {
+        return false;
+    }
+    const uint8_t *p = k->map + offset;
+    uint64_t total = ENTRY_FIXED;
+    entry->fp = p;
+    entry->user_len = get32(p + SHA256_BYTES);
+    total += entry->user_len;
+    for (int i = 0; i < FIELDS; i++) {
+        entry->len[i] = get32(p + SHA256_BYTES + 4 * (i + 1));
+        total += entry->len[i];
+    }
+    if (total > k->size - offset || entry->user_len >= USER_MAX) {
+        return false;
+    }
+    p += ENTRY_FIXED;
+    entry->user = p;
+    p += entry->user_len;
+    for (int i = 0; i < FIELDS; i++) {
+        entry->field[i] = p;
+        p += entry->len[i];
+    }
+    return true;
+}
+
+// Copies an entry out into numbers and a username.
+static void load_entry(Entry *entry, mpz_t n, mpz_t e, mpz_t s, mpz_t d, char username[]) {
+    mpz_ptr out[FIELDS] = { n, e, s, d };
+    for (int i = 0; i < FIELDS; i++) {
+        mpz_import(out[i], entry->len[i], 1, sizeof(uint8_t), 1, 0, entry->field[i]);
+    }
+    memcpy(username, entry->user, entry->user_len);
+    username[entry->user_len] = '\0';
+}
+
+// Opens a keyring by mapping it into memory. Returns NULL if it is missing or malformed.
+//
+// path: the keyring file
+Keyring *keyring_open(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    Keyring *k = (Keyring *) calloc(1, sizeof(Keyring));
+    if (!k || fstat(fd, &info) || info.st_size < HEADER_BYTES) {
+        close(fd);
+        free(k);
+        return NULL;
+    }
+    k->size = info.st_size;
+    k->map = (uint8_t *) mmap(NULL, k->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (k->map == MAP_FAILED) {
+        free(k);
+        return NULL;
+    }
+    madvise(k->map, k->size, MADV_RANDOM); // Lookups touch only a few pages
+    k->count = get64(k->map + 8);
+    k->buckets = get64(k->map + 16);
+    k->users = get64(k->map + 24);
+    k->prints = get64(k->map + 32);
+    uint64_t table = k->buckets * 8;
+    if (memcmp(k->map, MAGIC, 8) || !k->buckets || (k->buckets & (k->buckets - 1))
+        || k->buckets > k->size / 8 || k->count >= k->buckets || k->users > k->size - table
+        || k->prints > k->size - table) {
+        keyring_close(&k);
+        return NULL;
+    }
+    return k;
+}
+
+// Unmaps and frees a keyring.
+//
+// k: the keyring to close
+void keyring_close(Keyring **k) {
+    if (!*k) {
+        return;
+    }
+    munmap((*k)->map, (*k)->size);
+    free(*k);
+    *k = NULL;
+    return;
+}
+
+// Returns the number of keys in the keyring.
+//
+// k: the keyring
+uint64_t keyring_count(Keyring *k) {
+    return k->count;
+}
+
+// Probes one of the tables for an entry matching a key.
+//
+// k    : the keyring
+// table: the offset of the table to probe
+// key  : the username or fingerprint
+// len  : the length of the key
+// entry: the matching entry
+static bool find(Keyring *k, uint64_t table, const uint8_t *key, uint64_t len, Entry *entry) {
+    uint64_t mask = k->buckets - 1, slot = hash(key, len) & mask;
+    for (uint64_t probes = 0; probes < k->buckets; probes++, slot = (slot + 1) & mask) {
+        uint64_t offset = get64(k->map + table + 8 * slot);
+        if (!offset || !read_entry(k, offset, entry)) {
+            return false;
+        }
+        bool match = table == k->users ? entry->user_len == len && !memcmp(entry->user, key, len)
+                                       : !memcmp(entry->fp, key, len);
+        if (match) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Looks up a key by username, or by its fingerprint given as 64 hex digits.
+// d is set to 0 if the keyring only holds the public key.
+//
+// k       : the keyring
+// name    : the username or fingerprint
+// n       : the public product
+// e       : the public exponent
+// s       : the signature of the user
+// d       : the private key
+// username: the stored username (at least USER_MAX bytes)
+bool keyring_lookup(Keyring *k, char *name, mpz_t n, mpz_t e, mpz_t s, mpz_t d, char username[]) {
+    Entry entry;
+    uint64_t len = strlen(name);
+    bool found = find(k, k->users, (uint8_t *) name, len, &entry);
+    if (!found && len == 2 * SHA256_BYTES && strspn(name, "0123456789abcdefABCDEF") == len) {
+        uint8_t fp[SHA256_BYTES];
+        for (int i = 0; i < SHA256_BYTES; i++) {
+            sscanf(name + 2 * i, "%2hhx", &fp[i]);
+        }
+        found = find(k, k->prints, fp, SHA256_BYTES, &entry);
+    }
+    if (found) {
+        load_entry(&entry, n, e, s, d, username);
+    }
+    return found;
+}
+
+// Iterates over every key in the keyring. Start with a cursor of 0.
+//
+// k       : the keyring
+// cursor  : the iteration state
+// n       : the public product
+// e       : the public exponent
+// s       : the signature of the user
+// d       : the private key
+// username: the stored username (at least USER_MAX bytes)
+bool keyring_next(Keyring *k, uint64_t *cursor, mpz_t n, mpz_t e, mpz_t s, mpz_t d, char username[]) {
+    Entry entry;
+    for (; *cursor < k->buckets; *cursor += 1) {
+        uint64_t offset = get64(k->map + k->users + 8 * *cursor);
+        if (offset && read_entry(k, offset, &entry)) {
+            *cursor += 1;
+            load_entry(&entry, n, e, s, d, username);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Places an entry offset in the first free slot of a table.
+static void insert(uint8_t *table, uint64_t buckets, const uint8_t *key, uint64_t len, uint64_t offset) {
+    uint64_t slot = hash(key, len) & (buckets - 1);
+    while (get64(table + 8 * slot)) {
+        slot = (slot + 1) & (buckets - 1);
+    }
+    put64(table + 8 * slot, offset);
+}
+
+// Serializes the entries into a complete keyring image.
+//
+// entries: the entries to write
+// count  : the number of entries
+// size   : the size of the image
+static uint8_t *build(Entry *entries, uint64_t count, uint64_t *size) {
+    uint64_t buckets = MIN_BUCKETS;
+    while (buckets < 2 * count) {
+        buckets *= 2;
+    }
+    uint64_t data = HEADER_BYTES + 2 * 8 * buckets;
+    *size = data;
+    for (uint64_t i = 0; i < count; i++) {
+        *size += entry_size(&entries[i]);
+    }
+    uint8_t *image = (uint8_t *) calloc(*size, sizeof(uint8_t));
+    if (!image) {
+        return NULL;
+    }
+    memcpy(image, MAGIC, 8);
+    put64(image + 8, count);
+    put64(image + 16, buckets);
+    put64(image + 24, HEADER_BYTES);
+    put64(image + 32, HEADER_BYTES + 8 * buckets);
+    for (uint64_t i = 0, offset = data; i < count; offset += entry_size(&entries[i]), i++) {
+        Entry *entry = &entries[i];
+        uint8_t *p = image + offset;
+        memcpy(p, entry->fp, SHA256_BYTES);
+        put32(p + SHA256_BYTES, entry->user_len);
+        for (int j = 0; j < FIELDS; j++) {
+            put32(p + SHA256_BYTES + 4 * (j + 1), entry->len[j]);
+        }
+        p += ENTRY_FIXED;
+        memcpy(p, entry->user, entry->user_len);
+        p += entry->user_len;
+        for (int j = 0; j < FIELDS; j++) {
+            memcpy(p, entry->field[j], entry->len[j]);
+            p += entry->len[j];
+        }
+        insert(image + HEADER_BYTES, buckets, entry->user, entry->user_len, offset);
+        insert(image + HEADER_BYTES + 8 * buckets, buckets, entry->fp, SHA256_BYTES, offset);
+    }
+    return image;
+}
+
+// Writes an image next to the keyring and atomically replaces the keyring with it.
+static bool replace(char *path, uint8_t *image, uint64_t size) {
+    char temp[4096];
+    if ((size_t) snprintf(temp, sizeof(temp), "%s.tmp", path) >= sizeof(temp)) {
+        return false;
+    }
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return false;
+    }
+    uint64_t written = 0;
+    while (written < size) {
+        ssize_t count = write(fd, image + written, size - written);
+        if (count < 0 && errno != EINTR) {
+            break;
+        }
+        written += count > 0 ? (uint64_t) count : 0;
+    }
+    bool ok = written == size && !fsync(fd);
+    ok = !close(fd) && ok && !rename(temp, path);
+    if (!ok) {
+        unlink(temp);
+    }
+    return ok;
+}
+
+// Adds a key to a keyring, creating the keyring if needed and replacing any key with the
+// same username. The keyring is rewritten and swapped in atomically. Returns false,
+// leaving the keyring as it was, if it cannot be written or is corrupt.
+//
+// path    : the keyring file
+// n       : the public product
+// e       : the public exponent
+// s       : the signature of the user
+// d       : the private key, or 0 to store only the public key
+// username: the username of the user
+bool keyring_add(char *path, mpz_t n, mpz_t e, mpz_t s, mpz_t d, char username[]) {
+    char lockpath[4096];
+    if (strlen(username) >= USER_MAX
+        || (size_t) snprintf(lockpath, sizeof(lockpath), "%s.lock", path) >= sizeof(lockpath)) {
+        return false;
+    }
+    int lock = open(lockpath, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (lock < 0 || flock(lock, LOCK_EX)) {
+        if (lock >= 0) {
+            close(lock);
+        }
+        return false;
+    }
+
+    Keyring *old = keyring_open(path);
+    if (!old && access(path, F_OK) == 0) { // Never replace a keyring we cannot read
+        close(lock);
+        return false;
+    }
+    uint64_t existing = old ? old->count : 0, count = 0, seen = 0;
+    Entry *entries = (Entry *) calloc(existing + 1, sizeof(Entry));
+    uint8_t *bytes[FIELDS] = { NULL }, fp[SHA256_BYTES];
+    mpz_ptr fields[FIELDS] = { n, e, s, d };
+    bool ok = entries != NULL;
+    for (uint64_t slot = 0; ok && old && slot < old->buckets; slot++) {
+        uint64_t offset = get64(old->map + old->users + 8 * slot);
+        if (offset && seen++ == existing) { // More keys in the table than the header counts
+            ok = false;
+        } else if (offset && read_entry(old, offset, &entries[count])
+            && !(entries[count].user_len == strlen(username)
+                 && !memcmp(entries[count].user, username, entries[count].user_len))) {
+            count += 1;
+        }
+    }
+
+    Entry *added = ok ? &entries[count++] : NULL;
+    for (int i = 0; ok && i < FIELDS; i++) {
+        size_t len = 0;
+        bytes[i] = (uint8_t *) malloc((mpz_sizeinbase(fields[i], 2) + 7) / 8);
+        ok = bytes[i] != NULL;
+        if (ok) {
+            mpz_export(bytes[i], &len, 1, sizeof(uint8_t), 1, 0, fields[i]);
+            added->field[i] = bytes[i], added->len[i] = (uint32_t) len;
+        }
+    }
+    if (ok) {
+        rsa_fingerprint(fp, n, e, s, username);
+        added->fp = fp;
+        added->user = (uint8_t *) username, added->user_len = (uint32_t) strlen(username);
+        uint64_t size = 0;
+        uint8_t *image = build(entries, count, &size);
+        ok = image && replace(path, image, size);
+        free(image);
+    }
+    for (int i = 0; i < FIELDS; i++) {
+        free(bytes[i]);
+    }
+    free(entries);
+    keyring_close(&old);
+    flock(lock, LOCK_UN);
+    close(lock);
+    return ok;
+}
+
+// Reads one key out of a keyring, reporting why if it cannot. Any of e, s, d and
+// username may be NULL when they are not needed. Asking for d refuses keys that were
+// stored without their private key.
+//
+// path    : the keyring file
+// name    : the username or fingerprint
+// n       : the public product
+// e       : the public exponent, or NULL
+// s       : the signature of the user, or NULL
+// d       : the private key, or NULL
+// username: the stored username (at least USER_MAX bytes), or NULL
+bool keyring_read(char *path, char *name, mpz_t n, mpz_t e, mpz_t s, mpz_t d, char username[]) {
+    Keyring *k = keyring_open(path);
+    if (!k) {
+        fprintf(stderr, "Unable to open keyring %s.\n", path);
+        return false;
+    }
+    char user[USER_MAX];
+    mpz_t unused_e, unused_s, unused_d;
+    mpz_inits(unused_e, unused_s, unused_d, NULL);
+    bool found = keyring_lookup(k, name, n, e ? e : unused_e, s ? s : unused_s, d ? d : unused_d,
+        username ? username : user);
+    if (!found) {
+        fprintf(stderr, "No key for %s in keyring %s.\n", name, path);
+    } else if (d && mpz_cmp_ui(d, 0) == 0) {
+        fprintf(stderr, "Keyring %s has no private key for %s.\n", path, name);
+        found = false;
+    }
+    mpz_clears(unused_e, unused_s, unused_d, NULL);
+    keyring_close(&k);
+    return found;
+}
+
+// Splits a "keyring:name" reference in place at its last colon.
+//
+// ref : the reference, modified in place
+// path: the keyring file
+// name: the username or fingerprint
+bool keyring_reference(char *ref, char **path, char **name) {
+    char *colon = strrchr(ref, ':');
+    if (!colon || colon == ref || colon[1] == '\0') {
+        return false;
+    }
+    *colon = '\0';
+    *path = ref, *name = colon + 1;
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gmp.h>
+
+typedef struct Keyring Keyring;
+
+Keyring *keyring_open(char *path);
+
+void keyring_close(Keyring **k);
+
+uint64_t keyring_count(Keyring *k);
+
+bool keyring_lookup(Keyring *k, char *name, mpz_t n, mpz_t e, mpz_t s, mpz_t d, char username[]);
+
+bool keyring_next(Keyring *k, uint64_t *cursor, mpz_t n, mpz_t e, mpz_t s, mpz_t d, char username[]);
+
+bool keyring_add(char *path, mpz_t n, mpz_t e, mpz_t s, mpz_t d, char username[]);
+
+bool keyring_read(char *path, char *name, mpz_t n, mpz_t e, mpz_t s, mpz_t d, char username[]);
+
+bool keyring_reference(char *ref, char **path, char **name);
@@ -0,0 +1,136 @@
+#include "lz.h"
+#include <string.h>
+
+// Each sequence is a token (high nibble: literal count, low nibble: match length - 4, with 15
+// meaning more length bytes follow), the literals, then a 2 byte little endian offset and any
+// extra match length bytes. The final sequence holds only literals and ends the input.
+
+#define MIN_MATCH  4
+#define HASH_BITS  12
+#define MAX_OFFSET 65535
+#define TAIL       5 // Bytes at the end that are always left as literals
+
+// Hashes the 4 bytes at p into a table index.
+static uint32_t hash(const uint8_t *p) {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return (word * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Writes an extended length (the part past 15) as a run of 255s and a final byte.
+static uint8_t *put_length(uint8_t *op, uint64_t len) {
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+// Writes a sequence of literals followed by an optional match.
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *literals, uint64_t count, uint64_t offset, uint64_t match) {
+    uint8_t *token = op++;
+    *token = (uint8_t) ((count < 15 ? count : 15) << 4);
+    if (count >= 15) {
+        op = put_length(op, count - 15);
+    }
+    memcpy(op, literals, count);
+    op += count;
+    if (match) {
+        uint64_t extra = match - MIN_MATCH;
+        *token |= (uint8_t) (extra < 15 ? extra : 15);
+        *op++ = (uint8_t) offset, *op++ = (uint8_t) (offset >> 8);
+        if (extra >= 15) {
+            op = put_length(op, extra - 15);
+        }
+    }
+    return op;
+}
+
+// Returns the largest compressed size for an input of len bytes.
+//
+// len: the input size
+uint64_t lz_bound(uint64_t len) {
+    return len + len / 255 + 16;
+}
+
+// Compresses a buffer with a greedy single probe LZ77 and returns the compressed size.
+//
+// src: the bytes to compress
+// len: the number of bytes (at most LZ_FRAME)
+// dst: the output, at least lz_bound(len) bytes
+uint64_t lz_compress(const uint8_t *src, uint64_t len, uint8_t *dst) {
+    uint32_t table[1 << HASH_BITS] = { 0 }; // Last position + 1 for each hash
+    uint8_t *op = dst;
+    uint64_t anchor = 0, pos = 0;
+    while (len > TAIL && pos + MIN_MATCH <= len - TAIL) {
+        uint32_t h = hash(src + pos);
+        uint64_t candidate = table[h];
+        table[h] = (uint32_t) pos + 1;
+        if (!candidate || pos - (candidate - 1) > MAX_OFFSET || memcmp(src + candidate - 1, src + pos, MIN_MATCH)) {
+            pos += 1;
+            continue;
+        }
+        uint64_t ref = candidate - 1, match = MIN_MATCH;
+        while (pos + match < len - TAIL && src[ref + match] == src[pos + match]) {
+            match += 1;
+        }
+        op = put_sequence(op, src + anchor, pos - anchor, pos - ref, match);
+        pos += match;
+        anchor = pos;
+    }
+    op = put_sequence(op, src + anchor, len - anchor, 0, 0);
+    return op - dst;
+}
+
+// Reads an extended length, returning false if it runs off the input.
+static bool get_length(const uint8_t **ip, const uint8_t *end, uint64_t *len) {
+    uint8_t byte;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Decompresses a buffer produced by lz_compress. Returns false if the input is malformed
+// or does not expand to exactly dstlen bytes.
+//
+// src   : the compressed bytes
+// len   : the number of compressed bytes
+// dst   : the output buffer
+// dstlen: the expected decompressed size
+bool lz_decompress(const uint8_t *src, uint64_t len, uint8_t *dst, uint64_t dstlen) {
+    const uint8_t *ip = src, *end = src + len;
+    uint64_t out = 0;
+    while (ip < end) {
+        uint8_t token = *ip++;
+        uint64_t count = token >> 4, match = token & 15;
+        if ((count == 15 && !get_length(&ip, end, &count)) || count > (uint64_t) (end - ip) || count > dstlen - out) {
+            return false;
+        }
+        memcpy(dst + out, ip, count);
+        ip += count, out += count;
+        if (ip == end) { // Final literal only sequence
+            break;
+        }
+        if (end - ip < 2) {
+            return false;
+        }
+        uint64_t offset = ip[0] | (uint64_t) ip[1] << 8;
+        ip += 2;
+        if ((match == 15 && !get_length(&ip, end, &match)) || offset == 0 || offset > out) {
+            return false;
+        }
+        match += MIN_MATCH;
+        if (match > dstlen - out) {
+            return false;
+        }
+        for (uint64_t i = 0; i < match; i++, out++) { // Byte copy since matches may overlap
+            dst[out] = dst[out - offset];
+        }
+    }
+    return out == dstlen;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LZ_FRAME 65536 // Largest input compressed at once
+
+uint64_t lz_bound(uint64_t len);
+
+uint64_t lz_compress(const uint8_t *src, uint64_t len, uint8_t *dst);
+
+bool lz_decompress(const uint8_t *src, uint64_t len, uint8_t *dst, uint64_t dstlen);
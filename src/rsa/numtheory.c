@@ -1,5 +1,16 @@
 #include "numtheory.h"
 #include "randstate.h"
+#include "pool.h"
+#include "tune.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PARALLEL_BITS 2048 // Smallest numbers whose rounds are spread over threads
+#define WINDOW_BITS   5 // Exponent bits consumed per table lookup in pow_mod_window
+#define WINDOW_SIZE   (1 << WINDOW_BITS)
+
+static Pool *mr_pool = NULL;
 
 // Calculates the greatest common divisor between two numbers.
 //
@@ -55,13 +66,13 @@ void mod_inverse(mpz_t i, mpz_t a, mpz_t n) {
     return;
 }
 
-// Finds the modulus of base to the power of exponent.
+// Finds the modulus of base to the power of exponent with plain square and multiply.
 //
 // expoenent: the exponent power
 // modulus  : the modulus to use
 // base     : the base of the exponent
 // out      : the modulus of the product
-void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+void pow_mod_binary(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
     mpz_t approx, t_base, t_exponent;
     mpz_inits(approx, t_exponent, t_base, NULL);
     mpz_set_ui(approx, 1); // Approximate value
@@ -80,7 +91,296 @@ void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
     mpz_clears(approx, t_base, t_exponent, NULL);
 }
 
-// Determines whether a number has a high chance of being a prime number.
+// Returns an all ones mask if a equals b and zero otherwise, without branching.
+static mp_limb_t ct_mask(mp_limb_t a, mp_limb_t b) {
+    mp_limb_t diff = a ^ b;
+    return ((diff | (0 - diff)) >> (GMP_NUMB_BITS - 1)) - 1;
+}
+
+// Reads one table entry by touching every entry, so the memory access pattern does not
+// depend on the index. Entries are interleaved limb by limb, so each gather walks the
+// same contiguous rows whatever the index is.
+//
+// rp   : the entry read
+// table: the interleaved power table
+// limbs: the limbs per entry
+// index: the entry to read
+static void gather(mp_limb_t *rp, mp_limb_t *table, mp_size_t limbs, mp_limb_t index) {
+    for (mp_size_t i = 0; i < limbs; i++) {
+        mp_limb_t limb = 0, *row = table + i * WINDOW_SIZE;
+        for (mp_limb_t j = 0; j < WINDOW_SIZE; j++) {
+            limb |= row[j] & ct_mask(j, index);
+        }
+        rp[i] = limb;
+    }
+}
+
+// Stores a table entry at its interleaved position.
+static void scatter(mp_limb_t *table, mp_limb_t *ap, mp_size_t limbs, mp_limb_t index) {
+    for (mp_size_t i = 0; i < limbs; i++) {
+        table[i * WINDOW_SIZE + index] = ap[i];
+    }
+}
+
+// Computes -1 / m mod 2^GMP_NUMB_BITS for Montgomery reduction by Newton iteration.
+//
+// m: the lowest limb of an odd modulus
+static mp_limb_t mont_inverse(mp_limb_t m) {
+    mp_limb_t inverse = m; // Correct to 3 bits since m * m = 1 mod 8
+    for (int i = 0; i < 6; i++) {
+        inverse *= 2 - m * inverse;
+    }
+    return 0 - inverse;
+}
+
+// Montgomery state shared by every multiplication of one exponentiation.
+typedef struct {
+    const mp_limb_t *mp; // Odd modulus
+    mp_size_t limbs;
+    mp_limb_t minv; // -1 / mp mod 2^GMP_NUMB_BITS
+    mp_limb_t *product; // 2 * limbs of scratch for the double width product
+    mp_limb_t *reduced; // limbs of scratch for the final subtraction
+    mp_limb_t *scratch; // Scratch for mpn_sec_mul and mpn_sec_sqr
+} Montgomery;
+
+// Reduces the double width product into rp = product / R mod m, with one conditional
+// subtraction done by masking rather than branching.
+//
+// rp: the reduced result
+// mt: the Montgomery state
+static void mont_reduce(mp_limb_t *rp, Montgomery *mt) {
+    mp_limb_t *up = mt->product;
+    for (mp_size_t i = 0; i < mt->limbs; i++, up++) {
+        mp_limb_t q = up[0] * mt->minv;
+        up[0] = mpn_addmul_1(up, mt->mp, mt->limbs, q); // Low limb is now zero, keep the carry
+    }
+    mp_limb_t carry = mpn_add_n(rp, up, up - mt->limbs, mt->limbs);
+    mp_limb_t borrow = mpn_sub_n(mt->reduced, rp, mt->mp, mt->limbs);
+    mpn_cnd_swap(carry | (borrow ^ 1), rp, mt->reduced, mt->limbs);
+}
+
+// rp = ap * bp / R mod m. rp may alias ap or bp.
+static void mont_mul(mp_limb_t *rp, mp_limb_t *ap, mp_limb_t *bp, Montgomery *mt) {
+    if (ap == bp) {
+        mpn_sec_sqr(mt->product, ap, mt->limbs, mt->scratch);
+    } else {
+        mpn_sec_mul(mt->product, ap, mt->limbs, bp, mt->limbs, mt->scratch);
+    }
+    mont_reduce(rp, mt);
+}
+
+// Copies x * R mod m into a zero padded limb array.
+static void to_montgomery(mp_limb_t *rp, mpz_t x, mpz_t modulus, mp_size_t limbs) {
+    mpz_t t;
+    mpz_init(t);
+    mpz_mul_2exp(t, x, limbs * GMP_NUMB_BITS);
+    mpz_mod(t, t, modulus);
+    mpn_zero(rp, limbs);
+    mpz_export(rp, NULL, -1, sizeof(mp_limb_t), 0, 0, t);
+    mpz_clear(t);
+}
+
+// Finds the modulus of base to the power of exponent in constant time with a fixed window
+// and Montgomery multiplication. The sequence of squarings and multiplications depends only
+// on the limb counts of the exponent and modulus, and every table lookup reads the whole
+// table. Used for private key operations, so the modulus must be odd.
+//
+// expoenent: the secret exponent
+// modulus  : the odd modulus to use
+// base     : the base of the exponent
+// out      : the modulus of the product
+void pow_mod_window(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+    mp_size_t limbs = mpz_size(modulus);
+    if (mpz_even_p(modulus) || mpz_cmp_ui(modulus, 1) <= 0) { // Montgomery needs an odd modulus
+        pow_mod_binary(out, base, exponent, modulus);
+        return;
+    }
+    mp_size_t itch = mpn_sec_mul_itch(limbs, limbs);
+    itch = mpn_sec_sqr_itch(limbs) > itch ? mpn_sec_sqr_itch(limbs) : itch;
+    mp_size_t total = limbs * WINDOW_SIZE + 5 * limbs + itch;
+    mp_limb_t *table = (mp_limb_t *) calloc(total, sizeof(mp_limb_t));
+    if (!table) {
+        pow_mod_binary(out, base, exponent, modulus);
+        return;
+    }
+    mp_limb_t *result = table + limbs * WINDOW_SIZE, *entry = result + limbs;
+    Montgomery mt = { mpz_limbs_read(modulus), limbs, 0, entry + limbs, entry + 3 * limbs, entry + 4 * limbs };
+    mt.minv = mont_inverse(mt.mp[0]);
+
+    // table[j] = base^j * R mod modulus. The base is public so converting it may branch.
+    mpz_t one;
+    mpz_init_set_ui(one, 1);
+    to_montgomery(result, one, modulus, limbs);
+    mpz_clear(one);
+    scatter(table, result, limbs, 0);
+    to_montgomery(entry, base, modulus, limbs);
+    scatter(table, entry, limbs, 1);
+    mpn_copyi(result, entry, limbs);
+    for (mp_limb_t j = 2; j < WINDOW_SIZE; j++) {
+        mont_mul(result, result, entry, &mt);
+        scatter(table, result, limbs, j);
+    }
+
+    // Every limb of the exponent is processed so only its limb count is visible
+    uint64_t bits = mpz_size(exponent) * GMP_NUMB_BITS;
+    bits = (bits + WINDOW_BITS - 1) / WINDOW_BITS * WINDOW_BITS;
+    gather(result, table, limbs, 0);
+    for (uint64_t window = bits; window > 0; window -= WINDOW_BITS) {
+        mp_limb_t index = 0;
+        for (uint64_t bit = window; bit > window - WINDOW_BITS; bit--) {
+            index = index << 1 | mpz_tstbit(exponent, bit - 1);
+            mont_mul(result, result, result, &mt);
+        }
+        gather(entry, table, limbs, index);
+        mont_mul(result, result, entry, &mt);
+    }
+
+    // Leave the Montgomery domain by reducing result * 1
+    mpn_zero(mt.product, 2 * limbs);
+    mpn_copyi(mt.product, result, limbs);
+    mont_reduce(result, &mt);
+    mp_limb_t *dest = mpz_limbs_write(out, limbs);
+    mpn_copyi(dest, result, limbs);
+    mpz_limbs_finish(out, limbs);
+    memset(table, 0, total * sizeof(mp_limb_t));
+    free(table);
+    return;
+}
+
+// Finds the modulus of base to the power of exponent with GMP's sliding window powm.
+//
+// expoenent: the exponent power
+// modulus  : the modulus to use
+// base     : the base of the exponent
+// out      : the modulus of the product
+void pow_mod_gmp(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+    mpz_powm(out, base, exponent, modulus);
+    return;
+}
+
+// Finds the modulus of base to the power of exponent with GMP's side channel silent powm.
+// mpz_powm_sec only takes odd moduli and positive exponents, which every RSA private key
+// operation satisfies, so anything else is public and takes the plain GMP path.
+//
+// expoenent: the secret exponent
+// modulus  : the odd modulus to use
+// base     : the base of the exponent
+// out      : the modulus of the product
+void pow_mod_gmp_sec(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+    if (mpz_even_p(modulus) || mpz_sgn(exponent) <= 0) {
+        mpz_powm(out, base, exponent, modulus);
+        return;
+    }
+    mpz_powm_sec(out, base, exponent, modulus);
+    return;
+}
+
+// Finds the modulus of base to the power of exponent with whichever backend the tuning file
+// picked for the size of the modulus and exponent.
+//
+// expoenent: the exponent power
+// modulus  : the modulus to use
+// base     : the base of the exponent
+// out      : the modulus of the product
+void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+    tune_select(exponent, modulus, false)(out, base, exponent, modulus);
+    return;
+}
+
+// Finds the modulus of base to the power of exponent with the constant time backend the
+// tuning file picked for the size of the modulus. Used for private key operations, so the modulus must be odd.
+//
+// expoenent: the secret exponent
+// modulus  : the odd modulus to use
+// base     : the base of the exponent
+// out      : the modulus of the product
+void pow_mod_sec(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+    tune_select(exponent, modulus, true)(out, base, exponent, modulus);
+    return;
+}
+
+// Runs one Miller-Rabin round and reports whether the base proves n composite.
+//
+// n       : the number to check
+// n_sub1  : n - 1
+// r       : the odd part of n - 1
+// exponent: the power of two in n - 1
+// a       : the base to test
+static bool witness(mpz_t n, mpz_t n_sub1, mpz_t r, int64_t exponent, mpz_t a) {
+    bool composite = false;
+    mpz_t y, two;
+    mpz_inits(y, two, NULL);
+    mpz_set_ui(two, 2);
+    pow_mod(y, a, r, n);
+    if (mpz_cmp_ui(y, 1) != 0 && mpz_cmp(y, n_sub1) != 0) {
+        for (int64_t j = 1; j <= exponent - 1 && mpz_cmp(y, n_sub1) != 0; j++) {
+            pow_mod(y, y, two, n);
+            if (mpz_cmp_ui(y, 1) == 0) {
+                break;
+            }
+        }
+        composite = mpz_cmp(y, n_sub1) != 0;
+    }
+    mpz_clears(y, two, NULL);
+    return composite;
+}
+
+// Draws a random base in the range [2, n - 2] from the calling thread's stream.
+//
+// a: the random base
+// n: the number being tested
+static void random_base(mpz_t a, mpz_t n) {
+    mpz_t n_sub2;
+    mpz_init(n_sub2);
+    mpz_sub_ui(n_sub2, n, 3);
+    if (mpz_cmp_ui(n_sub2, 3) < 0) {
+        mpz_set_ui(a, 2);
+    } else {
+        randstate_urandomm(a, n_sub2);
+        mpz_add_ui(a, a, 2);
+    }
+    mpz_clear(n_sub2);
+}
+
+// A share of the Miller-Rabin rounds for one worker.
+typedef struct {
+    mpz_ptr n, n_sub1, r;
+    int64_t exponent;
+    uint64_t rounds;
+    atomic_bool *composite; // Set by the first failing witness to stop every worker
+} Rounds;
+
+// Runs a share of the rounds on a pool worker with bases from that worker's stream.
+//
+// arg: the rounds to run
+static void run_rounds(void *arg) {
+    Rounds *share = (Rounds *) arg;
+    mpz_t a;
+    mpz_init(a);
+    for (uint64_t i = 0; i < share->rounds && !atomic_load(share->composite); i++) {
+        random_base(a, share->n);
+        if (witness(share->n, share->n_sub1, share->r, share->exponent, a)) {
+            atomic_store(share->composite, true);
+        }
+    }
+    mpz_clear(a);
+}
+
+// Sets the number of threads is_prime spreads its rounds over for large numbers.
+// Passing 0 or 1 stops the threads. Not safe to call while is_prime is running.
+//
+// threads: the number of worker threads
+void numtheory_threads(uint64_t threads) {
+    pool_delete(&mr_pool);
+    if (threads > 1) {
+        mr_pool = pool_create(threads);
+    }
+    return;
+}
+
+// Determines whether a number has a high chance of being a prime number. Numbers of at
+// least PARALLEL_BITS bits that pass the first round have their remaining rounds split
+// across the threads set by numtheory_threads.
 //
 // iters: the number of iterations to use for the Miller-Rabin primality testing
 // n    : the number to check
@@ -96,48 +396,39 @@ bool is_prime(mpz_t n, uint64_t iters) {
     }
     // Find a s and r such that r is odd and n - 1 = (2^s) * r
     int64_t exponent = 0;
-    mpz_t temp, r, n_sub1, two;
-    mpz_inits(two, r, n_sub1, temp, NULL);
-    mpz_set_ui(two, 2);
+    mpz_t r, n_sub1, a;
+    mpz_inits(r, n_sub1, a, NULL);
     mpz_sub_ui(n_sub1, n, 1);
     mpz_set(r, n_sub1);
     // The idea below is from Professor Long
     while (mpz_even_p(r)) {
-        mpz_fdiv_q(r, r, two);
+        mpz_fdiv_q_2exp(r, r, 1);
         exponent += 1;
     }
-    mpz_t iter, random, n_sub2, y, j, s_sub1;
-    mpz_inits(iter, y, j, s_sub1, n_sub2, random, NULL);
-
-    // Main portion of the Miller-Rabin primality test
-    for (mpz_set_ui(iter, 1); mpz_cmp_ui(iter, iters) < 0; mpz_add_ui(iter, iter, 1)) {
-        mpz_sub_ui(n_sub2, n, 3);
-        if (mpz_cmp_ui(n_sub2, 3) < 0) {
-            mpz_set_ui(random, 2);
-        } else {
-            mpz_urandomm(random, state, n_sub2);
-            mpz_add_ui(random, random, 2);
+
+    // Main portion of the Miller-Rabin primality test. Most composites fail the first
+    // round, so only numbers that pass it are worth fanning out.
+    atomic_bool composite = false;
+    uint64_t rounds = iters > 1 ? iters - 1 : 0, done = 0;
+    for (; done < rounds && !composite; done++) {
+        if (done == 1 && mr_pool && mpz_sizeinbase(n, 2) >= PARALLEL_BITS) {
+            break;
         }
-        pow_mod(y, random, r, n);
-        if (mpz_cmp_ui(y, 1) != 0 && mpz_cmp(y, n_sub1) != 0) {
-            mpz_set_ui(j, 1);
-            mpz_set_ui(s_sub1, exponent - 1);
-            while (exponent - 1 >= 0 && mpz_cmp(j, s_sub1) <= 0 && mpz_cmp(y, n_sub1) != 0) {
-                pow_mod(y, y, two, n);
-                if (mpz_cmp_ui(y, 1) == 0) {
-                    mpz_clears(r, two, n_sub1, iter, random, n_sub2, y, j, s_sub1, NULL);
-                    return false;
-                }
-                mpz_add_ui(j, j, 1);
-            }
-            if (mpz_cmp(y, n_sub1) != 0) {
-                mpz_clears(r, two, n_sub1, iter, random, n_sub2, y, j, s_sub1, NULL);
-                return false;
-            }
+        random_base(a, n);
+        composite = witness(n, n_sub1, r, exponent, a);
+    }
+    if (!composite && done < rounds) {
+        uint64_t workers = pool_threads(mr_pool), left = rounds - done;
+        uint64_t tasks = left < workers ? left : workers;
+        Rounds shares[tasks];
+        for (uint64_t i = 0; i < tasks; i++) {
+            shares[i] = (Rounds) { n, n_sub1, r, exponent, left / tasks + (i < left % tasks), &composite };
+            pool_submit(mr_pool, run_rounds, &shares[i]);
         }
+        pool_wait(mr_pool);
     }
-    mpz_clears(r, two, n_sub1, iter, random, n_sub2, y, j, s_sub1, NULL);
-    return true;
+    mpz_clears(r, n_sub1, a, NULL);
+    return !composite;
 }
 
 // Generates a prime that is at least bits number of bits long.
@@ -146,10 +437,10 @@ bool is_prime(mpz_t n, uint64_t iters) {
 // bits : the minimum number of bits the prime number must be
 // p    : the final prime number
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
-    mpz_urandomb(p, state, bits + 1);
+    randstate_urandomb(p, bits + 1);
     // Finds a random prime number that is at least bits long
     while (mpz_sizeinbase(p, 2) < bits || !is_prime(p, iters)) {
-        mpz_urandomb(p, state, bits + 1);
+        randstate_urandomb(p, bits + 1);
     }
     return;
 }
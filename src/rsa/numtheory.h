@@ -11,6 +11,18 @@ void mod_inverse(mpz_t i, mpz_t a, mpz_t n);
 
 void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
 
+void pow_mod_sec(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
+
+void pow_mod_binary(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
+
+void pow_mod_window(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
+
+void pow_mod_gmp(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
+
+void pow_mod_gmp_sec(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
+
+void numtheory_threads(uint64_t threads);
+
 bool is_prime(mpz_t n, uint64_t iters);
 
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters);
@@ -0,0 +1,250 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    Task task;
+    void *arg;
+} Job;
+
+// A worker's queue. Jobs are pushed at the tail and the owner runs them in order from the
+// head, while idle workers steal from the tail. Callers that queue their longest jobs
+// first therefore have them started first, and only the short ones left at the end move
+// between workers.
+typedef struct {
+    pthread_mutex_t lock;
+    Job *jobs;
+    uint64_t head, tail, capacity;
+} Deque;
+
+struct Pool {
+    uint64_t threads;
+    pthread_t *workers;
+    Deque *deques;
+    pthread_mutex_t lock;
+    pthread_cond_t work; // Signalled when jobs are queued or the pool stops
+    pthread_cond_t idle; // Signalled when every submitted job has finished
+    uint64_t queued; // Jobs in some deque that no worker has claimed yet
+    uint64_t pending; // Jobs submitted but not yet finished
+    uint64_t next; // Round robin deque for jobs submitted from outside the pool
+    bool stop;
+};
+
+typedef struct {
+    Pool *pool;
+    uint64_t index;
+} Worker;
+
+static _Thread_local Pool *current_pool = NULL;
+static _Thread_local uint64_t current_index = 0;
+
+// Pushes a job onto the tail of a deque, growing it if full.
+//
+// d  : the deque
+// job: the job to push
+static bool deque_push(Deque *d, Job job) {
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->capacity) {
+        if (d->head > 0) { // Reclaim the space left by stolen jobs
+            for (uint64_t i = d->head; i < d->tail; i++) {
+                d->jobs[i - d->head] = d->jobs[i];
+            }
+            d->tail -= d->head, d->head = 0;
+        } else {
+            uint64_t capacity = d->capacity ? d->capacity * 2 : 16;
+            Job *jobs = (Job *) realloc(d->jobs, capacity * sizeof(Job));
+            if (!jobs) {
+                pthread_mutex_unlock(&d->lock);
+                return false;
+            }
+            d->jobs = jobs, d->capacity = capacity;
+        }
+    }
+    d->jobs[d->tail++] = job;
+    pthread_mutex_unlock(&d->lock);
+    return true;
+}
+
+// Takes a job from a deque, either from the head (owner) or the tail (thief).
+//
+// d    : the deque
+// job  : the job taken
+// steal: whether to take from the tail
+static bool deque_take(Deque *d, Job *job, bool steal) {
+    pthread_mutex_lock(&d->lock);
+    bool found = d->head < d->tail;
+    if (found) {
+        *job = steal ? d->jobs[--d->tail] : d->jobs[d->head++];
+        if (d->head == d->tail) {
+            d->head = d->tail = 0;
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+// Finds the next job for a worker, preferring its own deque before stealing.
+//
+// p    : the pool
+// index: the worker looking for work
+// job  : the job found
+static bool find_job(Pool *p, uint64_t index, Job *job) {
+    if (deque_take(&p->deques[index], job, false)) {
+        return true;
+    }
+    for (uint64_t i = 1; i < p->threads; i++) {
+        if (deque_take(&p->deques[(index + i) % p->threads], job, true)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Main loop of each worker thread.
+//
+// arg: the worker's pool and index
+static void *work(void *arg) {
+    Worker *w = (Worker *) arg;
+    Pool *p = w->pool;
+    current_pool = p, current_index = w->index;
+    Job job;
+    while (true) {
+        pthread_mutex_lock(&p->lock);
+        while (p->queued == 0 && !p->stop) {
+            pthread_cond_wait(&p->work, &p->lock);
+        }
+        if (p->queued == 0 && p->stop) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        p->queued -= 1; // Claim one job, which stays in some deque until this worker takes it
+        pthread_mutex_unlock(&p->lock);
+
+        // Every claimed job is already pushed, so this only repeats if another claimant
+        // took the job this scan would have found while a new one landed behind it.
+        while (!find_job(p, w->index, &job)) {
+            continue;
+        }
+        job.task(job.arg);
+
+        pthread_mutex_lock(&p->lock);
+        if (--p->pending == 0) {
+            pthread_cond_broadcast(&p->idle);
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+    free(w);
+    return NULL;
+}
+
+// Creates a work stealing thread pool.
+//
+// threads: the number of worker threads (at least one)
+Pool *pool_create(uint64_t threads) {
+    Pool *p = (Pool *) calloc(1, sizeof(Pool));
+    if (!p) {
+        return NULL;
+    }
+    p->threads = threads ? threads : 1;
+    p->workers = (pthread_t *) calloc(p->threads, sizeof(pthread_t));
+    p->deques = (Deque *) calloc(p->threads, sizeof(Deque));
+    if (!p->workers || !p->deques) {
+        free(p->workers), free(p->deques), free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    for (uint64_t i = 0; i < p->threads; i++) {
+        pthread_mutex_init(&p->deques[i].lock, NULL);
+    }
+    for (uint64_t i = 0; i < p->threads; i++) {
+        Worker *w = (Worker *) malloc(sizeof(Worker));
+        if (w) {
+            w->pool = p, w->index = i;
+        }
+        if (!w || pthread_create(&p->workers[i], NULL, work, w)) {
+            free(w);
+            p->threads = i; // Only join the workers that started
+            pool_delete(&p);
+            return NULL;
+        }
+    }
+    return p;
+}
+
+// Stops the workers once all queued jobs have run and frees the pool.
+//
+// p: the pool to delete
+void pool_delete(Pool **p) {
+    if (!*p) {
+        return;
+    }
+    pthread_mutex_lock(&(*p)->lock);
+    (*p)->stop = true;
+    pthread_cond_broadcast(&(*p)->work);
+    pthread_mutex_unlock(&(*p)->lock);
+    for (uint64_t i = 0; i < (*p)->threads; i++) {
+        pthread_join((*p)->workers[i], NULL);
+    }
+    for (uint64_t i = 0; i < (*p)->threads; i++) {
+        pthread_mutex_destroy(&(*p)->deques[i].lock);
+        free((*p)->deques[i].jobs);
+    }
+    pthread_mutex_destroy(&(*p)->lock);
+    pthread_cond_destroy(&(*p)->work);
+    pthread_cond_destroy(&(*p)->idle);
+    free((*p)->workers);
+    free((*p)->deques);
+    free(*p);
+    *p = NULL;
+    return;
+}
+
+// Queues a job. Jobs submitted by a worker go onto its own deque; others are spread
+// round robin. If the job cannot be queued it runs on the calling thread instead.
+//
+// p   : the pool
+// task: the function to run
+// arg : the argument passed to the function
+void pool_submit(Pool *p, Task task, void *arg) {
+    pthread_mutex_lock(&p->lock);
+    uint64_t index = current_pool == p ? current_index : p->next++ % p->threads;
+    p->pending += 1;
+    pthread_mutex_unlock(&p->lock);
+
+    bool pushed = deque_push(&p->deques[index], (Job) { task, arg });
+    if (!pushed) {
+        task(arg);
+    }
+    pthread_mutex_lock(&p->lock);
+    if (pushed) {
+        p->queued += 1; // Only counted once it is visible, so a claimed job can always be found
+        pthread_cond_signal(&p->work);
+    } else if (--p->pending == 0) {
+        pthread_cond_broadcast(&p->idle);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return;
+}
+
+// Blocks until every submitted job has finished. Must not be called from a worker.
+//
+// p: the pool
+void pool_wait(Pool *p) {
+    pthread_mutex_lock(&p->lock);
+    while (p->pending > 0) {
+        pthread_cond_wait(&p->idle, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return;
+}
+
+// Returns the number of worker threads in the pool.
+//
+// p: the pool
+uint64_t pool_threads(Pool *p) {
+    return p->threads;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct Pool Pool;
+
+typedef void (*Task)(void *arg);
+
+Pool *pool_create(uint64_t threads);
+
+void pool_delete(Pool **p);
+
+void pool_submit(Pool *p, Task task, void *arg);
+
+void pool_wait(Pool *p);
+
+uint64_t pool_threads(Pool *p);
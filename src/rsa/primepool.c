@@ -0,0 +1,261 @@
+#include "primepool.h"
+#include "numtheory.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HEADER        "#skip %020lu\n" // Offset of the first line that may hold an unused prime
+#define HEADER_BYTES  27
+#define TAKEN         '-' // Written over the first byte of a prime's line once it is handed out
+#define COMPACT_BYTES (1 << 16) // Smallest run of taken lines worth rewriting the pool for
+
+// A prime pool is a text file with one "<key bits> <prime in hex>" line per prime. Every
+// prime for a key size of nbits has at least nbits / 2 + 1 bits, so any two of them
+// multiply to a modulus of at least nbits bits.
+//
+// Taking primes only marks their lines as taken and moves the offset in the header line
+// past them, so a key costs a few small writes rather than a copy of the pool. Once the
+// taken lines make up most of the pool it is rewritten without them.
+
+// Opens the pool, refusing files that other users could read or write since the primes
+// in it become private keys.
+//
+// path : the pool file
+// flags: the open flags
+static int open_pool(char *path, int flags) {
+    int fd = open(path, flags, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open prime pool %s: %s.\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) || info.st_uid != geteuid() || (info.st_mode & (S_IRWXG | S_IRWXO))) {
+        fprintf(stderr, "Refusing unprotected prime pool %s.\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Takes the pool's lock file. The pool itself is replaced by rename when it is
+// compacted, so it cannot carry the lock.
+//
+// path: the pool file
+static int lock_pool(char *path) {
+    char lockpath[4096];
+    if ((size_t) snprintf(lockpath, sizeof(lockpath), "%s.lock", path) >= sizeof(lockpath)) {
+        return -1;
+    }
+    int lock = open(lockpath, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (lock >= 0 && flock(lock, LOCK_EX)) {
+        close(lock);
+        return -1;
+    }
+    return lock;
+}
+
+// Releases the pool's lock file.
+static void unlock_pool(int lock) {
+    flock(lock, LOCK_UN);
+    close(lock);
+}
+
+// Generates primes for keys of nbits bits and appends them to the pool as they are found.
+// A count of 0 keeps filling until the process is stopped. Returns the number of primes added.
+//
+// path : the pool file
+// nbits: the key size the primes are for
+// count: the number of primes to add
+// iters: the number of iterations for the Miller-Rabin primality testing
+uint64_t primepool_fill(char *path, uint64_t nbits, uint64_t count, uint64_t iters) {
+    mpz_t prime;
+    mpz_init(prime);
+    uint64_t added = 0;
+    while (count == 0 || added < count) {
+        make_prime(prime, nbits / 2 + 1, iters);
+        int lock = lock_pool(path), fd = lock < 0 ? -1 : open_pool(path, O_WRONLY | O_CREAT | O_APPEND);
+        FILE *pool = fd < 0 ? NULL : fdopen(fd, "a");
+        struct stat info;
+        bool written = pool && !fstat(fd, &info);
+        if (written && info.st_size == 0) { // A new pool starts with its header
+            written = fprintf(pool, HEADER, (uint64_t) HEADER_BYTES) == HEADER_BYTES;
+        }
+        written = written && gmp_fprintf(pool, "%lu %Zx\n", nbits, prime) > 0 && !fflush(pool) && !fsync(fd);
+        if (pool) {
+            fclose(pool);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        if (lock >= 0) {
+            unlock_pool(lock);
+        }
+        if (!written) {
+            break;
+        }
+        added += 1;
+    }
+    mpz_clear(prime);
+    return added;
+}
+
+// Reads the header of the pool. Returns false if it is missing or malformed.
+//
+// pool: the pool, positioned at its start
+// skip: the offset of the first line that may hold an unused prime
+static bool read_header(FILE *pool, uint64_t *skip) {
+    char header[HEADER_BYTES + 1];
+    *skip = 0;
+    if (!fgets(header, sizeof(header), pool) || sscanf(header, "#skip %20lu", skip) != 1 || *skip < HEADER_BYTES) {
+        *skip = 0;
+        return false;
+    }
+    return true;
+}
+
+// Rewrites the pool without its taken lines and atomically replaces it. The pool is
+// read afresh so that lines just marked as taken are not copied from a stale buffer.
+//
+// path: the pool file
+static bool compact_pool(char *path) {
+    char temp[4096];
+    if ((size_t) snprintf(temp, sizeof(temp), "%s.tmp", path) >= sizeof(temp)) {
+        return false;
+    }
+    int in = open_pool(path, O_RDONLY), fd = in < 0 ? -1 : open(temp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    FILE *pool = in < 0 ? NULL : fdopen(in, "r"), *out = fd < 0 ? NULL : fdopen(fd, "w");
+    if (!pool || !out) {
+        if (pool) {
+            fclose(pool);
+        } else if (in >= 0) {
+            close(in);
+        }
+        if (out) {
+            fclose(out);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    char *line = NULL;
+    size_t length = 0;
+    bool ok = fprintf(out, HEADER, (uint64_t) HEADER_BYTES) == HEADER_BYTES;
+    while (ok && getline(&line, &length, pool) != -1) {
+        if (line[0] != TAKEN && line[0] != '#') {
+            ok = fputs(line, out) != EOF;
+        }
+    }
+    free(line);
+    ok = ok && !ferror(pool) && !fflush(out) && !fsync(fd);
+    fclose(pool);
+    ok = !fclose(out) && ok && !rename(temp, path);
+    if (!ok) {
+        unlink(temp);
+    }
+    return ok;
+}
+
+// Scans the pool from the header's offset for two distinct primes for keys of nbits bits.
+// Returns false and reports why if the pool cannot be read, is corrupt or runs out.
+//
+// path : the pool file, for messages
+// pool : the pool
+// nbits: the key size the primes are for
+// out  : the two primes found
+// at   : the offsets of the lines of the two primes
+// skip : the header's offset, moved past every line that is now taken
+static bool find_primes(char *path, FILE *pool, uint64_t nbits, mpz_ptr out[2], uint64_t at[2], uint64_t *skip) {
+    if (fseeko(pool, *skip, SEEK_SET)) {
+        fprintf(stderr, "Unable to read prime pool %s.\n", path);
+        return false;
+    }
+    char *line = NULL;
+    size_t length = 0;
+    ssize_t got = 0;
+    uint64_t taken = 0, offset = *skip, live = UINT64_MAX, start = 0;
+    bool corrupt = false;
+    while (taken < 2 && (got = getline(&line, &length, pool)) != -1) {
+        start = offset;
+        offset += got;
+        if (line[0] == TAKEN || line[0] == '#') {
+            continue;
+        }
+        char *hex = NULL;
+        uint64_t bits = strtoul(line, &hex, 10);
+        corrupt = hex == line || gmp_sscanf(hex, " %Zx", out[taken]) != 1;
+        if (corrupt) {
+            break;
+        } else if (bits == nbits && mpz_sizeinbase(out[taken], 2) > nbits / 2
+            && (taken == 0 || mpz_cmp(out[0], out[1]) != 0)) {
+            at[taken++] = start;
+        } else if (live == UINT64_MAX) {
+            live = start; // First prime left in the pool
+        }
+    }
+    free(line);
+    if (ferror(pool)) {
+        fprintf(stderr, "Unable to read prime pool %s.\n", path);
+    } else if (corrupt) {
+        fprintf(stderr, "Corrupt prime pool %s at byte %lu.\n", path, start);
+    } else if (taken < 2) {
+        fprintf(stderr, "Prime pool %s has fewer than two primes for %lu bit keys.\n", path, nbits);
+    }
+    *skip = live < offset ? live : offset;
+    return taken == 2 && !corrupt && !ferror(pool);
+}
+
+// Removes two distinct primes for keys of nbits bits from the pool so that a prime is
+// never handed out twice. Both lines are marked as taken and synced before the primes are
+// returned. Returns false, after reporting why, if no primes could be taken.
+//
+// path : the pool file
+// nbits: the key size the primes are for
+// p    : the first prime number
+// q    : the second prime number
+bool primepool_take(char *path, uint64_t nbits, mpz_t p, mpz_t q) {
+    int lock = lock_pool(path);
+    if (lock < 0) {
+        fprintf(stderr, "Unable to lock prime pool %s.\n", path);
+        return false;
+    }
+    int fd = open_pool(path, O_RDWR), copy = fd < 0 ? -1 : dup(fd);
+    FILE *pool = copy < 0 ? NULL : fdopen(copy, "r");
+    if (!pool && copy >= 0) {
+        close(copy);
+    }
+    mpz_ptr out[2] = { p, q };
+    uint64_t at[2], skip = 0;
+    char taken = TAKEN, header[HEADER_BYTES + 1];
+    bool headed = pool && read_header(pool, &skip);
+    if (pool && !headed) {
+        fprintf(stderr, "Prime pool %s has no valid header.\n", path);
+    }
+    bool ok = headed && find_primes(path, pool, nbits, out, at, &skip);
+    if (ok) {
+        ok = pwrite(fd, &taken, 1, at[0]) == 1 && pwrite(fd, &taken, 1, at[1]) == 1;
+        snprintf(header, sizeof(header), HEADER, skip);
+        ok = ok && pwrite(fd, header, HEADER_BYTES, 0) == HEADER_BYTES && !fdatasync(fd);
+        if (!ok) {
+            fprintf(stderr, "Unable to update prime pool %s.\n", path);
+        }
+        // Pools that are mostly taken lines are rewritten. The primes are already marked as
+        // taken, so a failed rewrite only costs space.
+        struct stat info;
+        if (ok && skip > COMPACT_BYTES && !fstat(fd, &info) && skip > (uint64_t) info.st_size / 2
+            && !compact_pool(path)) {
+            fprintf(stderr, "Unable to compact prime pool %s.\n", path);
+        }
+    }
+    if (pool) {
+        fclose(pool);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlock_pool(lock);
+    return ok;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gmp.h>
+
+uint64_t primepool_fill(char *path, uint64_t nbits, uint64_t count, uint64_t iters);
+
+bool primepool_take(char *path, uint64_t nbits, mpz_t p, mpz_t q);
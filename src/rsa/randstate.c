@@ -1,18 +1,185 @@
 #include "randstate.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
 
-gmp_randstate_t state;
+#define KEY_WORDS     8
+#define BLOCK_WORDS   16
+#define BLOCK_BYTES   64
+#define BUFFER_BLOCKS 16 // Keystream blocks generated per refill
+#define BUFFER_BYTES  (BLOCK_BYTES * BUFFER_BLOCKS)
+#define ROTL(x, n)    (((x) << (n)) | ((x) >> (32 - (n))))
 
-// Initializes a random state and set the seed for future random calls.
+// A ChaCha20 keystream owned by a single thread. Every thread shares the master key but
+// draws from its own stream id (the ChaCha20 nonce), so streams never overlap.
+typedef struct {
+    uint64_t generation; // Master key generation the stream was keyed with
+    uint64_t id; // Stream id used as the nonce
+    uint64_t counter; // Next block counter
+    uint32_t pos; // Next unused byte in the buffer
+    uint8_t buffer[BUFFER_BYTES];
+} Stream;
+
+static uint32_t master[KEY_WORDS];
+static atomic_uint_fast64_t generation = 0;
+static atomic_uint_fast64_t next_id = 0;
+static atomic_bool seeded = false; // Whether a master key is installed
+static _Thread_local Stream stream;
+
+// Produces a single 64 byte ChaCha20 block.
+//
+// out    : the block of keystream
+// key    : the 256 bit key
+// counter: the block counter
+// id     : the stream id
+static void chacha_block(uint8_t out[BLOCK_BYTES], uint32_t key[KEY_WORDS], uint64_t counter, uint64_t id) {
+    uint32_t input[BLOCK_WORDS] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+    memcpy(input + 4, key, KEY_WORDS * sizeof(uint32_t));
+    input[12] = (uint32_t) counter, input[13] = (uint32_t) (counter >> 32);
+    input[14] = (uint32_t) id, input[15] = (uint32_t) (id >> 32);
+
+    uint32_t x[BLOCK_WORDS];
+    memcpy(x, input, sizeof(x));
+#define QR(a, b, c, d)                                                                             \
+    x[a] += x[b], x[d] ^= x[a], x[d] = ROTL(x[d], 16);                                             \
+    x[c] += x[d], x[b] ^= x[c], x[b] = ROTL(x[b], 12);                                             \
+    x[a] += x[b], x[d] ^= x[a], x[d] = ROTL(x[d], 8);                                              \
+    x[c] += x[d], x[b] ^= x[c], x[b] = ROTL(x[b], 7)
+    for (int round = 0; round < 10; round++) { // 20 rounds as 10 column/diagonal pairs
+        QR(0, 4, 8, 12), QR(1, 5, 9, 13), QR(2, 6, 10, 14), QR(3, 7, 11, 15);
+        QR(0, 5, 10, 15), QR(1, 6, 11, 12), QR(2, 7, 8, 13), QR(3, 4, 9, 14);
+    }
+#undef QR
+    for (int i = 0; i < BLOCK_WORDS; i++) { // Little endian serialization
+        uint32_t word = x[i] + input[i];
+        out[4 * i] = (uint8_t) word, out[4 * i + 1] = (uint8_t) (word >> 8);
+        out[4 * i + 2] = (uint8_t) (word >> 16), out[4 * i + 3] = (uint8_t) (word >> 24);
+    }
+}
+
+// Refills the calling thread's buffer, keying a fresh stream first if the master key changed.
+static void refill(void) {
+    uint64_t current = atomic_load(&generation);
+    if (stream.generation != current) {
+        stream.generation = current;
+        stream.id = atomic_fetch_add(&next_id, 1);
+        stream.counter = 0;
+    }
+    for (uint32_t i = 0; i < BUFFER_BLOCKS; i++) {
+        chacha_block(stream.buffer + i * BLOCK_BYTES, master, stream.counter++, stream.id);
+    }
+    stream.pos = 0;
+}
+
+// Installs a new master key and invalidates every existing thread stream.
+//
+// key: the 32 byte master key
+static void rekey(uint8_t key[KEY_WORDS * 4]) {
+    for (int i = 0; i < KEY_WORDS; i++) {
+        master[i] = (uint32_t) key[4 * i] | (uint32_t) key[4 * i + 1] << 8
+                    | (uint32_t) key[4 * i + 2] << 16 | (uint32_t) key[4 * i + 3] << 24;
+    }
+    atomic_store(&next_id, 0);
+    atomic_fetch_add(&generation, 1);
+    atomic_store(&seeded, true);
+    stream.pos = BUFFER_BYTES;
+}
+
+// Initializes the random state deterministically from a seed. Streams are handed out in the
+// order threads first draw from them, so single threaded runs are fully reproducible.
 //
 // seed: the seed for the random state
 void randstate_init(uint64_t seed) {
-    gmp_randinit_mt(state);
-    gmp_randseed_ui(state, seed);
+    uint8_t key[KEY_WORDS * 4] = { 0 };
+    for (int i = 0; i < 8; i++) {
+        key[i] = (uint8_t) (seed >> (8 * i));
+    }
+    rekey(key);
     return;
 }
 
-// Frees any memory used to create the random state.
+// Initializes the random state with a key taken from the operating system.
+// Returns false if the operating system could not provide any entropy.
+bool randstate_init_os(void) {
+    uint8_t key[KEY_WORDS * 4];
+    size_t filled = 0;
+    while (filled < sizeof(key)) {
+        ssize_t got = getrandom(key + filled, sizeof(key) - filled, 0);
+        if (got < 0 && errno != EINTR) {
+            return false;
+        }
+        filled += got > 0 ? (size_t) got : 0;
+    }
+    rekey(key);
+    memset(key, 0, sizeof(key));
+    return true;
+}
+
+// Frees any memory used to create the random state. Drawing from it afterwards aborts.
 void randstate_clear(void) {
-    gmp_randclear(state);
+    atomic_store(&seeded, false);
+    memset(master, 0, sizeof(master));
+    memset(&stream, 0, sizeof(stream));
+    atomic_fetch_add(&generation, 1);
+    return;
+}
+
+// Fills a buffer with random bytes from the calling thread's stream. Aborts if the random
+// state is not initialized, since the all zero key would give predictable output.
+//
+// buf: the buffer to fill
+// len: the number of bytes to write
+void randstate_bytes(uint8_t *buf, size_t len) {
+    if (!atomic_load(&seeded)) {
+        fprintf(stderr, "Random state used without being initialized.\n");
+        abort();
+    }
+    while (len > 0) {
+        if (stream.pos >= BUFFER_BYTES || stream.generation != atomic_load(&generation)) {
+            refill();
+        }
+        size_t take = BUFFER_BYTES - stream.pos < len ? BUFFER_BYTES - stream.pos : len;
+        memcpy(buf, stream.buffer + stream.pos, take);
+        memset(stream.buffer + stream.pos, 0, take); // Never hand out the same bytes twice
+        stream.pos += take, buf += take, len -= take;
+    }
+    return;
+}
+
+// Generates a uniformly random number in the range [0, 2^bits - 1].
+//
+// rop : the random number
+// bits: the number of random bits
+void randstate_urandomb(mpz_t rop, uint64_t bits) {
+    if (bits == 0) {
+        mpz_set_ui(rop, 0);
+        return;
+    }
+    mp_size_t limbs = (bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+    mp_limb_t *dest = mpz_limbs_write(rop, limbs);
+    randstate_bytes((uint8_t *) dest, limbs * sizeof(mp_limb_t));
+    if (bits % GMP_NUMB_BITS) { // Drop the excess bits of the top limb
+        dest[limbs - 1] &= ((mp_limb_t) 1 << (bits % GMP_NUMB_BITS)) - 1;
+    }
+    mpz_limbs_finish(rop, limbs);
+    return;
+}
+
+// Generates a uniformly random number in the range [0, n - 1] by rejection sampling.
+//
+// rop: the random number
+// n  : the exclusive upper bound
+void randstate_urandomm(mpz_t rop, mpz_t n) {
+    if (mpz_cmp_ui(n, 0) <= 0) {
+        mpz_set_ui(rop, 0);
+        return;
+    }
+    uint64_t bits = mpz_sizeinbase(n, 2);
+    do {
+        randstate_urandomb(rop, bits);
+    } while (mpz_cmp(rop, n) >= 0);
     return;
 }
@@ -1,10 +1,18 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <gmp.h>
 
-extern gmp_randstate_t state;
-
 void randstate_init(uint64_t seed);
 
+bool randstate_init_os(void);
+
 void randstate_clear(void);
+
+void randstate_bytes(uint8_t *buf, size_t len);
+
+void randstate_urandomb(mpz_t rop, uint64_t bits);
+
+void randstate_urandomm(mpz_t rop, mpz_t n);
@@ -1,6 +1,61 @@
 #include "numtheory.h"
 #include "randstate.h"
+#include "rsa.h"
+#include "lz.h"
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define PLAIN_MARK      0xFF // First byte of a block of raw plaintext
+#define COMPRESSED_MARK 0xFE // First byte of a block of compressed frames
+#define FRAME_HEADER    9 // Frame type, raw length and compressed length
+#define DIGEST_CHUNK    (1 << 20) // Bytes hashed per read when signing files
+#define SCREEN_BITS     64 // Bits of each random weight in rsa_verify_batch
+#define STRINGIFY(x)    EXPAND(x) // Turns a numeric macro into a string literal
+#define EXPAND(x)       #x
+
+enum Frames { STORED, PACKED };
+
+// A blinding pair for one stream of private key operations. vf = (vi^-1)^d mod n, so
+// (c * vi)^d * vf = c^d, and squaring both keeps that true for the next block. The pair
+// made for a key also keeps the squares of its first values, which step it from one
+// derived pair to the next.
+struct Blind {
+    mpz_t vi; // Multiplies the input before exponentiating
+    mpz_t vf; // Multiplies the result to remove the blinding
+    mpz_t si; // Square of the key's first vi
+    mpz_t sf; // Square of the key's first vf
+    pthread_mutex_t lock; // Held while deriving a pair
+};
+
+// Picks a random public exponent coprime with the totient of n.
+//
+// e    : the public exponent
+// p    : the first prime number
+// q    : the second prime number
+// nbits: the number of bits of the exponent
+static void make_exponent(mpz_t e, mpz_t p, mpz_t q, uint64_t nbits) {
+    mpz_t left, right, totient;
+    mpz_inits(left, right, totient, NULL);
+    mpz_sub_ui(left, p, 1);
+    mpz_sub_ui(right, q, 1);
+    mpz_mul(totient, left, right); // totient(n) = (p - 1) * (q - 1)
+
+    bool found = false;
+    mpz_t random, divisor;
+    mpz_inits(random, divisor, NULL);
+    // Finds public exponent
+    while (!found) {
+        randstate_urandomb(random, nbits);
+        gcd(divisor, random, totient);
+        if (mpz_cmp_ui(divisor, 1) == 0) {
+            found = true;
+            mpz_set(e, random);
+        }
+    }
+    mpz_clears(left, right, totient, random, divisor, NULL);
+    return;
+}
 
 // Generate a public RSA key.
 //
@@ -23,7 +78,7 @@ void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t i
     mpz_set_ui(lower, nbits / 4);
     mpz_mul_ui(upper, lower, 3);
     mpz_sub(temp, upper, lower);
-    mpz_urandomm(bits1, state, temp);
+    randstate_urandomm(bits1, temp);
     mpz_add(bits1, bits1, lower);
     mpz_set_ui(bits2, nbits - mpz_get_ui(bits1));
 
@@ -36,27 +91,26 @@ void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t i
             found = true;
         }
     }
+    make_exponent(e, p, q, nbits);
+    mpz_clears(lower, upper, bits1, bits2, temp, NULL);
+    return;
+}
 
-    mpz_t left, right, totient;
-    mpz_inits(left, right, totient, NULL);
-    mpz_sub_ui(left, p, 1);
-    mpz_sub_ui(right, q, 1);
-    mpz_mul(totient, left, right); // totient(n) = (p - 1) * (q - 1)
-
-    found = false;
-    mpz_t random, divisor;
-    mpz_inits(random, divisor, NULL);
-    // Finds public exponent
-    while (!found) {
-        mpz_urandomb(random, state, nbits);
-        gcd(divisor, random, totient);
-        if (mpz_cmp_ui(divisor, 1) == 0) {
-            found = true;
-            mpz_set(e, random);
-        }
+// Generate a public RSA key from two existing primes, such as ones taken from a prime pool.
+// Returns false if the primes are equal or their product is shorter than nbits.
+//
+// nbits: the minimum number of bits of the product n
+// p    : the first prime number
+// q    : the second prime number
+// n    : the product of the two prime numbers
+// e    : the public exponent
+bool rsa_make_pub_from_primes(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits) {
+    mpz_mul(n, p, q);
+    if (nbits < 4 || mpz_cmp(p, q) == 0 || mpz_sizeinbase(n, 2) < nbits) {
+        return false;
     }
-    mpz_clears(lower, upper, bits1, bits2, temp, left, right, totient, random, divisor, NULL);
-    return;
+    make_exponent(e, p, q, nbits);
+    return true;
 }
 
 // Writes out the public key and a signature to a file.
@@ -76,7 +130,7 @@ void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile) {
 
 // Reads a public key from a file.
 //
-// username: the username of the current user
+// username: the username of the current user (at least USER_MAX bytes)
 // pbfile  : the file that contains the public key
 // n       : the product of the two primes
 // e       : the public exponent
@@ -85,7 +139,7 @@ void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile) {
     gmp_fscanf(pbfile, "%Zx\n", n);
     gmp_fscanf(pbfile, "%Zx\n", e);
     gmp_fscanf(pbfile, "%Zx\n", s);
-    gmp_fscanf(pbfile, "%s\n", username);
+    gmp_fscanf(pbfile, "%" STRINGIFY(USER_LEN) "s\n", username); // Bounded by USER_MAX
     return;
 }
 
@@ -139,13 +193,107 @@ void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n) {
     return;
 }
 
-// Encrypts a file's content and write it to a file.
+// Encrypts one block (marker byte and payload) and writes it to a file.
 //
-// outfile: the file to write the ciphertext into
-// infile : the file to encrypt
-// n      : the public product
-// e      : the public exponent
-void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
+// outfile  : the file to write the ciphertext into
+// block    : the block to encrypt
+// len      : the number of bytes in the block
+// message  : scratch space for the block as a number
+// encrypted: scratch space for the ciphertext
+// e        : the public exponent
+// n        : the public product
+static void encrypt_block(FILE *outfile, uint8_t *block, uint64_t len, mpz_t message, mpz_t encrypted, mpz_t e, mpz_t n) {
+    mpz_import(message, len, 1, sizeof(uint8_t), 1, 0, block);
+    rsa_encrypt(encrypted, message, e, n);
+    gmp_fprintf(outfile, "%Zx\n", encrypted);
+    return;
+}
+
+// Compresses the input into frames and encrypts the frames back to back, so a frame may
+// start in one block and end in another. Checkpoints are taken between frames and carry
+// the partly filled block. Returns false if the file could not be encrypted in full.
+//
+// infile   : the file to encrypt
+// outfile  : the file to write the ciphertext into
+// block    : a block of size bytes
+// size     : the size of a block
+// message  : scratch space for the block as a number
+// encrypted: scratch space for the ciphertext
+// e        : the public exponent
+// n        : the public product
+// ck       : the checkpoint to resume from and update, or NULL
+static bool encrypt_compressed(FILE *infile, FILE *outfile, uint8_t *block, uint64_t size, mpz_t message, mpz_t encrypted, mpz_t e, mpz_t n, Checkpoint *ck) {
+    if (size < 2) {
+        fprintf(stderr, "Key is too small to hold compressed data.\n");
+        return false;
+    }
+    uint64_t used = 1, blocks = 0;
+    if (!checkpoint_restore(ck, infile, outfile, n, block, size, &used, &blocks)) {
+        return false;
+    }
+    if (!checkpoint_saved(ck)) {
+        used = 1;
+    } else if (used < 1 || block[0] != COMPRESSED_MARK) {
+        fprintf(stderr, "Checkpoint was not made while compressing.\n");
+        return false;
+    }
+    uint8_t *raw = (uint8_t *) malloc(LZ_FRAME);
+    uint8_t *frame = (uint8_t *) malloc(FRAME_HEADER + lz_bound(LZ_FRAME));
+    if (!raw || !frame) {
+        free(raw), free(frame);
+        fprintf(stderr, "Unable to allocate memory for compression.\n");
+        return false;
+    }
+    block[0] = COMPRESSED_MARK;
+    uint64_t read = 0;
+    while ((read = fread(raw, sizeof(uint8_t), LZ_FRAME, infile)) > 0) {
+        uint64_t packed = lz_compress(raw, read, frame + FRAME_HEADER);
+        frame[0] = packed < read ? PACKED : STORED;
+        if (frame[0] == STORED) { // Incompressible data is kept as is
+            memcpy(frame + FRAME_HEADER, raw, read);
+            packed = read;
+        }
+        for (int i = 0; i < 4; i++) {
+            frame[1 + i] = (uint8_t) (read >> (24 - 8 * i));
+            frame[5 + i] = (uint8_t) (packed >> (24 - 8 * i));
+        }
+        for (uint64_t offset = 0, total = FRAME_HEADER + packed; offset < total;) {
+            uint64_t take = size - used < total - offset ? size - used : total - offset;
+            memcpy(block + used, frame + offset, take);
+            used += take, offset += take;
+            if (used == size) {
+                encrypt_block(outfile, block, used, message, encrypted, e, n);
+                used = 1, blocks++;
+            }
+        }
+        checkpoint_save(ck, infile, outfile, n, block, used, blocks);
+    }
+    if (used > 1) { // Last partial block
+        encrypt_block(outfile, block, used, message, encrypted, e, n);
+    }
+    bool done = !ferror(infile);
+    if (done) { // A failed read must leave the checkpoint to resume from
+        checkpoint_finish(ck);
+    } else {
+        fprintf(stderr, "Unable to read the file to encrypt.\n");
+    }
+    free(raw);
+    free(frame);
+    return done;
+}
+
+// Encrypts a file's content and write it to a file. With a checkpoint, the output is
+// synced and the position recorded every so many blocks, and a saved checkpoint is
+// resumed from instead of starting over. Returns false if the file could not be
+// encrypted in full.
+//
+// outfile : the file to write the ciphertext into
+// infile  : the file to encrypt
+// n       : the public product
+// e       : the public exponent
+// compress: whether to compress the content before encrypting it
+// ck      : the checkpoint, or NULL for none
+bool rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, bool compress, Checkpoint *ck) {
     mpz_t encrypted, size, message;
     mpz_inits(encrypted, size, message, NULL);
 
@@ -154,7 +302,7 @@ void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
     if (mpz_cmp_ui(size, 1) < 0) {
         mpz_clears(size, message, encrypted, NULL);
         fprintf(stderr, "Invalid size less than 1.\n");
-        return;
+        return false;
     }
 
     uint8_t *block = (uint8_t *) calloc(mpz_get_ui(size) + 1, sizeof(uint8_t));
@@ -162,20 +310,37 @@ void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
         mpz_clears(size, message, encrypted, NULL);
         free(block);
         fprintf(stderr, "Unable to allocate memory for the block.\n");
-        return;
+        return false;
     }
 
-    block[0] = 0xFF;
+    if (compress) {
+        bool done = encrypt_compressed(infile, outfile, block, mpz_get_ui(size), message, encrypted, e, n, ck);
+        mpz_clears(size, message, encrypted, NULL);
+        free(block);
+        return done;
+    }
+    block[0] = PLAIN_MARK;
     int64_t read = 0;
+    uint64_t blocks = 0, carried = 0;
+    if (!checkpoint_restore(ck, infile, outfile, n, NULL, 0, &carried, &blocks)) {
+        mpz_clears(size, message, encrypted, NULL);
+        free(block);
+        return false;
+    }
     while ((read = fread(block + 1, sizeof(uint8_t), mpz_get_ui(size) - 1, infile)) > 0) {
         // Convert bytes into mpz hexstrings
-        mpz_import(message, read + 1, 1, sizeof(uint8_t), 1, 0, block);
-        rsa_encrypt(encrypted, message, e, n);
-        gmp_fprintf(outfile, "%Zx\n", encrypted);
+        encrypt_block(outfile, block, read + 1, message, encrypted, e, n);
+        checkpoint_save(ck, infile, outfile, n, NULL, 0, ++blocks);
+    }
+    bool done = !ferror(infile);
+    if (done) { // A failed read must leave the checkpoint to resume from
+        checkpoint_finish(ck);
+    } else {
+        fprintf(stderr, "Unable to read the file to encrypt.\n");
     }
     mpz_clears(size, message, encrypted, NULL);
     free(block);
-    return;
+    return done;
 }
 
 // Decrypts a message using the private key.
@@ -185,17 +350,164 @@ void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
 // d: the private key
 // n: the public product
 void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n) {
-    pow_mod(m, c, d, n);
+    pow_mod_sec(m, c, d, n); // d is secret
     return;
 }
 
-// Decrypts a file's content and write it to a file.
+// Allocates a blinding pair with every value set to 0.
+static Blind *blind_alloc(void) {
+    Blind *b = (Blind *) malloc(sizeof(Blind));
+    if (!b) {
+        return NULL;
+    }
+    if (pthread_mutex_init(&b->lock, NULL)) {
+        free(b);
+        return NULL;
+    }
+    mpz_inits(b->vi, b->vf, b->si, b->sf, NULL);
+    return b;
+}
+
+// Creates the blinding pair for a private key, which rsa_blind_derive hands out pairs
+// from. Only d is needed, so this works with private key files that do not store e.
+// Costs one exponentiation and one inverse for the key, however many files it blinds.
+// Returns NULL if n is too small to blind or memory runs out.
+//
+// d: the private key
+// n: the public product
+Blind *rsa_blind_create(mpz_t d, mpz_t n) {
+    if (mpz_cmp_ui(n, 3) < 0) {
+        return NULL;
+    }
+    Blind *b = blind_alloc();
+    if (!b) {
+        return NULL;
+    }
+    mpz_t divisor;
+    mpz_init(divisor);
+    do { // vi must be invertible mod n
+        randstate_urandomm(b->vi, n);
+        gcd(divisor, b->vi, n);
+    } while (mpz_cmp_ui(b->vi, 1) <= 0 || mpz_cmp_ui(divisor, 1) != 0);
+    mod_inverse(b->vf, b->vi, n);
+    pow_mod_sec(b->vf, b->vf, d, n);
+    mpz_mul(b->si, b->vi, b->vi);
+    mpz_mod(b->si, b->si, n);
+    mpz_mul(b->sf, b->vf, b->vf);
+    mpz_mod(b->sf, b->sf, n);
+    mpz_clear(divisor);
+    return b;
+}
+
+// Derives a blinding pair for one stream of blocks from a key's pair, for two modular
+// multiplications. With v the key's first vi, the k-th pair derived starts at v^(2k + 1)
+// and each block squares it, so no two streams are ever blinded by the same value. Safe
+// to call from several threads. Returns NULL if memory runs out.
+//
+// b: the pair made by rsa_blind_create
+// n: the public product
+Blind *rsa_blind_derive(Blind *b, mpz_t n) {
+    Blind *pair = blind_alloc();
+    if (!pair) {
+        return NULL;
+    }
+    pthread_mutex_lock(&b->lock);
+    mpz_set(pair->vi, b->vi);
+    mpz_set(pair->vf, b->vf);
+    mpz_mul(b->vi, b->vi, b->si);
+    mpz_mod(b->vi, b->vi, n);
+    mpz_mul(b->vf, b->vf, b->sf);
+    mpz_mod(b->vf, b->vf, n);
+    pthread_mutex_unlock(&b->lock);
+    return pair;
+}
+
+// Frees a blinding pair.
+//
+// b: the blinding pair to delete
+void rsa_blind_delete(Blind **b) {
+    if (!*b) {
+        return;
+    }
+    mpz_clears((*b)->vi, (*b)->vf, (*b)->si, (*b)->sf, NULL);
+    pthread_mutex_destroy(&(*b)->lock);
+    free(*b);
+    *b = NULL;
+    return;
+}
+
+// Decrypts a message with the private key applied to a blinded ciphertext, so the value
+// being exponentiated is unrelated to c. The pair is then squared for the next block,
+// which costs two modular multiplications instead of a fresh exponentiation.
+//
+// m: the decrypted message
+// c: the ciphertext
+// d: the private key
+// n: the public product
+// b: the blinding pair, from rsa_blind_derive
+void rsa_decrypt_blind(mpz_t m, mpz_t c, mpz_t d, mpz_t n, Blind *b) {
+    mpz_mul(m, c, b->vi);
+    mpz_mod(m, m, n);
+    pow_mod_sec(m, m, d, n); // d is secret
+    mpz_mul(m, m, b->vf);
+    mpz_mod(m, m, n);
+    mpz_mul(b->vi, b->vi, b->vi);
+    mpz_mod(b->vi, b->vi, n);
+    mpz_mul(b->vf, b->vf, b->vf);
+    mpz_mod(b->vf, b->vf, n);
+    return;
+}
+
+// Decodes and writes out every complete frame at the start of the pending bytes, keeping
+// any incomplete frame for the next block. Returns false if a frame is malformed.
+//
+// pending: the compressed bytes received so far
+// len    : the number of pending bytes
+// raw    : a buffer of LZ_FRAME bytes
+// outfile: the file to write the decompressed bytes into
+static bool decode_frames(uint8_t *pending, uint64_t *len, uint8_t *raw, FILE *outfile) {
+    uint64_t start = 0;
+    while (*len - start >= FRAME_HEADER) {
+        uint8_t *frame = pending + start;
+        uint64_t raw_len = 0, packed = 0;
+        for (int i = 0; i < 4; i++) {
+            raw_len = raw_len << 8 | frame[1 + i];
+            packed = packed << 8 | frame[5 + i];
+        }
+        if (frame[0] > PACKED || raw_len > LZ_FRAME || packed > lz_bound(LZ_FRAME)
+            || (frame[0] == STORED && packed != raw_len)) {
+            return false;
+        }
+        if (*len - start < FRAME_HEADER + packed) {
+            break; // Rest of the frame is in later blocks
+        }
+        if (frame[0] == STORED) {
+            fwrite(frame + FRAME_HEADER, sizeof(uint8_t), raw_len, outfile);
+        } else if (lz_decompress(frame + FRAME_HEADER, packed, raw, raw_len)) {
+            fwrite(raw, sizeof(uint8_t), raw_len, outfile);
+        } else {
+            return false;
+        }
+        start += FRAME_HEADER + packed;
+    }
+    memmove(pending, pending + start, *len - start);
+    *len -= start;
+    return true;
+}
+
+// Decrypts a file's content and write it to a file. Blocks of compressed frames are
+// detected by their marker byte and decompressed. With a checkpoint, the output is synced
+// and the position recorded every so many blocks along with any partial frame, and a
+// saved checkpoint is resumed from instead of starting over. Returns false if the file
+// could not be decrypted in full.
 //
 // outfile: the file to write the decrypted bytes into
 // infile : the file to decrypt
 // n      : the public product
 // d      : the private key
-void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d) {
+// blind  : the key's blinding pair to derive a pair for this file from, or NULL for none
+// ck     : the checkpoint, or NULL for none
+bool rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d, Blind *blind, Checkpoint *ck) {
     mpz_t message, decrypted, size;
     mpz_inits(message, decrypted, size, NULL);
 
@@ -205,27 +517,65 @@ void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d) {
     if (mpz_cmp_ui(size, 1) < 0) {
         mpz_clears(message, decrypted, size, NULL);
         fprintf(stderr, "Invalid size less than 1.\n");
-        return;
+        return false;
     }
 
-    uint8_t *block = (uint8_t *) calloc(mpz_get_ui(size), sizeof(uint8_t));
-    if (!block) {
+    // A decrypted block can be as wide as n itself
+    uint64_t width = (mpz_sizeinbase(n, 2) + 7) / 8;
+    uint64_t capacity = FRAME_HEADER + lz_bound(LZ_FRAME) + width, pending_len = 0;
+    uint8_t *block = (uint8_t *) calloc(width, sizeof(uint8_t));
+    uint8_t *pending = (uint8_t *) malloc(capacity), *raw = (uint8_t *) malloc(LZ_FRAME);
+    Blind *pair = blind ? rsa_blind_derive(blind, n) : NULL;
+    if (!block || !pending || !raw || (blind && !pair)) {
         mpz_clears(size, message, decrypted, NULL);
-        free(block);
+        free(block), free(pending), free(raw);
+        rsa_blind_delete(&pair);
         fprintf(stderr, "Unable to allocate memory for the block.\n");
-        return;
+        return false;
     }
-    while (gmp_fscanf(infile, "%Zx\n", message) > 0) {
+    uint64_t blocks = 0;
+    bool intact = checkpoint_restore(ck, infile, outfile, n, pending, capacity, &pending_len, &blocks);
+    while (intact && gmp_fscanf(infile, "%Zx\n", message) > 0) {
         // Converts an mpz hexstring into an array of bytes
-        rsa_decrypt(decrypted, message, d, n);
+        if (pair) {
+            rsa_decrypt_blind(decrypted, message, d, n, pair);
+        } else {
+            rsa_decrypt(decrypted, message, d, n);
+        }
         mpz_export(block, &read, 1, sizeof(uint8_t), 1, 0, decrypted);
-        for (uint64_t i = 1; i < read; i++) {
-            gmp_fprintf(outfile, "%c", block[i]);
+        if (read >= 1 && block[0] != COMPRESSED_MARK) {
+            fwrite(block + 1, sizeof(uint8_t), read - 1, outfile);
+        } else if (read >= 1) {
+            memcpy(pending + pending_len, block + 1, read - 1);
+            pending_len += read - 1;
+            if (!decode_frames(pending, &pending_len, raw, outfile)) {
+                fprintf(stderr, "Corrupt compressed data.\n");
+                pending_len = 0;
+                intact = false;
+                break;
+            }
         }
+        checkpoint_save(ck, infile, outfile, n, pending, pending_len, ++blocks);
+    }
+    if (intact && ferror(infile)) {
+        fprintf(stderr, "Unable to read the file to decrypt.\n");
+        intact = false;
+    } else if (intact && !feof(infile)) {
+        fprintf(stderr, "Corrupt ciphertext.\n");
+        intact = false;
+    } else if (pending_len > 0) {
+        fprintf(stderr, "Truncated compressed data.\n");
+        intact = false;
+    }
+    if (intact) { // Anything else must leave the checkpoint to resume from
+        checkpoint_finish(ck);
     }
+    rsa_blind_delete(&pair);
     free(block);
+    free(pending);
+    free(raw);
     mpz_clears(message, decrypted, size, NULL);
-    return;
+    return intact;
 }
 
 // Signs the user's username to allow the recipient of a message to know the sender of the message.
@@ -235,7 +585,7 @@ void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d) {
 // d: the private key
 // n: the public product
 void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n) {
-    pow_mod(s, m, d, n);
+    pow_mod_sec(s, m, d, n); // d is secret
     return;
 }
 
@@ -253,3 +603,161 @@ bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n) {
     mpz_clear(t);
     return val;
 }
+
+// Verifies several signatures made with the same key at once using the small exponents
+// test: with random weights w_i in [1, 2^SCREEN_BITS), (prod s_i^w_i)^e = prod m_i^w_i
+// mod n holds for every valid set. A signature off by a factor u passes when the product
+// of the u_i^w_i happens to be 1, which for u = -1, the one such factor known without
+// factoring n, is a coin toss over the parity of the weights. So every s_i must also have
+// the Jacobi symbol of its m_i, which -s_i does not when n = 3 mod 4 since (-1/n) = -1.
+// Any other bad set passes with probability at most 2^-SCREEN_BITS. Keys with n = 1 mod 4,
+// or an even e, are not tested at all. Costs two SCREEN_BITS bit exponentiations per
+// signature plus a single one with e, so it only saves work when e is much longer than
+// SCREEN_BITS. Returns false if any signature may be bad or the key cannot be tested;
+// the caller has to check them one by one to find which.
+//
+// m    : the expected messages
+// s    : the signatures
+// count: the number of signatures
+// e    : the public exponent
+// n    : the public product
+bool rsa_verify_batch(mpz_ptr m[], mpz_ptr s[], uint64_t count, mpz_t e, mpz_t n) {
+    if (mpz_fdiv_ui(n, 4) != 3 || mpz_even_p(e)) { // -1 would go unnoticed
+        return false;
+    }
+    mpz_t left, right, weight, t;
+    mpz_inits(left, right, weight, t, NULL);
+    mpz_set_ui(left, 1), mpz_set_ui(right, 1);
+    bool val = true;
+    for (uint64_t i = 0; i < count; i++) {
+        if (mpz_sgn(m[i]) < 0 || mpz_cmp(m[i], n) >= 0) { // rsa_verify only accepts reduced messages
+            val = false;
+            break;
+        }
+        mpz_mod(t, s[i], n);
+        int symbol = mpz_jacobi(t, n);
+        if (symbol == 0 || symbol != mpz_jacobi(m[i], n)) { // s^e has the symbol of s for odd e
+            val = false;
+            break;
+        }
+        do {
+            randstate_urandomb(weight, SCREEN_BITS);
+        } while (mpz_sgn(weight) == 0);
+        pow_mod(t, t, weight, n);
+        mpz_mul(left, left, t);
+        mpz_mod(left, left, n);
+        pow_mod(t, m[i], weight, n);
+        mpz_mul(right, right, t);
+        mpz_mod(right, right, n);
+    }
+    if (val) {
+        pow_mod(left, left, e, n);
+        val = mpz_cmp(left, right) == 0;
+    }
+    mpz_clears(left, right, weight, t, NULL);
+    return val;
+}
+
+// Streams a file through SHA-256 and encodes the digest as a number below n:
+// 0x01 | 0xFF padding | digest. Returns false if the file could not be read or n has
+// fewer than SIGN_FILE_BITS bits, which leaves no room for the whole digest and at least
+// DIGEST_PAD bytes of padding.
+//
+// m     : the encoded digest
+// infile: the file to hash
+// n     : the public product
+static bool digest_file(mpz_t m, FILE *infile, mpz_t n) {
+    uint64_t width = (mpz_sizeinbase(n, 2) - 1) / 8; // Same block size as encryption
+    if (mpz_sizeinbase(n, 2) < SIGN_FILE_BITS) {
+        return false;
+    }
+    uint8_t *buffer = (uint8_t *) malloc(DIGEST_CHUNK);
+    uint8_t *encoded = (uint8_t *) malloc(width);
+    if (!buffer || !encoded) {
+        free(buffer), free(encoded);
+        return false;
+    }
+    SHA256 ctx;
+    uint8_t digest[SHA256_BYTES];
+    uint64_t read = 0;
+    sha256_init(&ctx);
+    while ((read = fread(buffer, sizeof(uint8_t), DIGEST_CHUNK, infile)) > 0) {
+        sha256_update(&ctx, buffer, read);
+    }
+    sha256_final(&ctx, digest);
+    bool ok = !ferror(infile);
+
+    encoded[0] = 0x01;
+    memset(encoded + 1, 0xFF, width - 1 - SHA256_BYTES);
+    memcpy(encoded + width - SHA256_BYTES, digest, SHA256_BYTES);
+    mpz_import(m, width, 1, sizeof(uint8_t), 1, 0, encoded);
+    free(buffer);
+    free(encoded);
+    return ok;
+}
+
+// Signs a whole file with a single exponentiation by signing its SHA-256 digest.
+// Returns false if the file could not be read or n has fewer than SIGN_FILE_BITS bits.
+//
+// s     : the detached signature
+// infile: the file to sign
+// d     : the private key
+// n     : the public product
+bool rsa_sign_file(mpz_t s, FILE *infile, mpz_t d, mpz_t n) {
+    mpz_t m;
+    mpz_init(m);
+    bool ok = digest_file(m, infile, n);
+    if (ok) {
+        rsa_sign(s, m, d, n);
+    }
+    mpz_clear(m);
+    return ok;
+}
+
+// Verifies a detached signature of a file. Keys with fewer than SIGN_FILE_BITS bits
+// never verify.
+//
+// infile: the signed file
+// s     : the detached signature
+// e     : the public exponent
+// n     : the public product
+bool rsa_verify_file(FILE *infile, mpz_t s, mpz_t e, mpz_t n) {
+    mpz_t m;
+    mpz_init(m);
+    bool ok = digest_file(m, infile, n) && rsa_verify(m, s, e, n);
+    mpz_clear(m);
+    return ok;
+}
+
+// Hashes a big-endian, length prefixed copy of a number into a digest.
+//
+// ctx: the digest state
+// x  : the number to hash
+static void hash_mpz(SHA256 *ctx, mpz_t x) {
+    size_t count = 0;
+    uint8_t *bytes = (uint8_t *) malloc((mpz_sizeinbase(x, 2) + 7) / 8);
+    mpz_export(bytes, &count, 1, sizeof(uint8_t), 1, 0, x);
+    uint8_t length[4] = { (uint8_t) (count >> 24), (uint8_t) (count >> 16), (uint8_t) (count >> 8),
+        (uint8_t) count };
+    sha256_update(ctx, length, sizeof(length));
+    sha256_update(ctx, bytes, count);
+    free(bytes);
+}
+
+// Computes a fingerprint identifying a public key and its signed username.
+//
+// fp      : the SHA-256 fingerprint
+// n       : the public product
+// e       : the public exponent
+// s       : the signature of the user
+// username: the username of the user
+void rsa_fingerprint(uint8_t fp[SHA256_BYTES], mpz_t n, mpz_t e, mpz_t s, char username[]) {
+    SHA256 ctx;
+    sha256_init(&ctx);
+    hash_mpz(&ctx, n);
+    hash_mpz(&ctx, e);
+    hash_mpz(&ctx, s);
+    sha256_update(&ctx, (uint8_t *) username, strlen(username));
+    sha256_final(&ctx, fp);
+    return;
+}
@@ -4,9 +4,20 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <gmp.h>
+#include "sha256.h"
+#include "checkpoint.h"
+
+#define USER_LEN 1023 // Longest username
+#define USER_MAX (USER_LEN + 1) // Username buffer size including the terminator
+#define DIGEST_PAD 8 // Fewest 0xFF bytes between the 0x01 and the digest of a signed file
+#define SIGN_FILE_BITS ((1 + DIGEST_PAD + SHA256_BYTES) * 8 + 1) // Smallest modulus that can sign files
+
+typedef struct Blind Blind;
 
 void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters);
 
+bool rsa_make_pub_from_primes(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits);
+
 void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
 
 void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
@@ -19,12 +30,28 @@ void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile);
 
 void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n);
 
-void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e);
+bool rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, bool compress, Checkpoint *ck);
 
 void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n);
 
-void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d);
+Blind *rsa_blind_create(mpz_t d, mpz_t n);
+
+Blind *rsa_blind_derive(Blind *b, mpz_t n);
+
+void rsa_blind_delete(Blind **b);
+
+void rsa_decrypt_blind(mpz_t m, mpz_t c, mpz_t d, mpz_t n, Blind *b);
+
+bool rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d, Blind *blind, Checkpoint *ck);
 
 void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n);
 
 bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n);
+
+bool rsa_verify_batch(mpz_ptr m[], mpz_ptr s[], uint64_t count, mpz_t e, mpz_t n);
+
+bool rsa_sign_file(mpz_t s, FILE *infile, mpz_t d, mpz_t n);
+
+bool rsa_verify_file(FILE *infile, mpz_t s, mpz_t e, mpz_t n);
+
+void rsa_fingerprint(uint8_t fp[SHA256_BYTES], mpz_t n, mpz_t e, mpz_t s, char username[]);
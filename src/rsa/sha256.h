@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BYTES 32
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t length;
+    uint8_t block[64];
+    uint32_t used;
+} SHA256;
+
+void sha256_init(SHA256 *ctx);
+
+void sha256_update(SHA256 *ctx, const uint8_t *data, size_t len);
+
+void sha256_final(SHA256 *ctx, uint8_t digest[SHA256_BYTES]);
@@ -0,0 +1,248 @@
+#include "tune.h"
+#include "numtheory.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHORT_BITS 64 // Longest exponent timed as short, such as 65537 or the squarings of Miller-Rabin
+#define TUNE_REPS  5 // Most timed runs per backend
+#define TUNE_NSEC  20000000 // Stop timing a backend after this many nanoseconds
+#define TUNE_SEED  0x7475 // Operands are fixed so every host times the same work
+#define UNTUNED    -1
+
+// The tuning file holds one "<public|secret> <modulus bits> <short|full> <backend>" line per
+// size class, for example "public 2048 full gmp". It only ever picks between backends that
+// are allowed for the class, so a stale or hand edited file can slow a host down but cannot
+// put a secret exponent through a variable time backend. The file is only written by
+// tune_calibrate; classes it does not list use a fixed default.
+
+enum Kinds { PUBLIC, SECRET, KINDS };
+enum Exponents { SHORT, FULL, EXPONENTS };
+enum Backends { BINARY, WINDOW, GMP, GMP_SEC, BACKENDS };
+
+static const char *kind_names[KINDS] = { "public", "secret" };
+static const char *exponent_names[EXPONENTS] = { "short", "full" };
+static const char *backend_names[BACKENDS] = { "binary", "window", "gmp", "gmp_sec" };
+static const PowMod backends[BACKENDS] = { pow_mod_binary, pow_mod_window, pow_mod_gmp, pow_mod_gmp_sec };
+static const bool constant_time[BACKENDS] = { false, true, false, true };
+static const int defaults[KINDS] = { GMP, GMP_SEC }; // For classes the tuning file does not list
+
+// Moduli are grouped by the smallest of these sizes they fit in; anything longer uses the last.
+static const uint64_t modulus_bits[] = { 512, 1024, 2048, 4096, 8192 };
+#define MODULI (sizeof(modulus_bits) / sizeof(modulus_bits[0]))
+
+static atomic_int chosen[KINDS][EXPONENTS][MODULI] = { { { 0 } } };
+static atomic_bool ready = false;
+static bool loaded = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Marks every class untuned. Called once under the lock before the tuning file is read.
+static void reset_choices(void) {
+    for (int k = 0; k < KINDS; k++) {
+        for (int x = 0; x < EXPONENTS; x++) {
+            for (size_t m = 0; m < MODULI; m++) {
+                atomic_store(&chosen[k][x][m], UNTUNED);
+            }
+        }
+    }
+}
+
+// Finds the size class of a modulus.
+//
+// modulus: the modulus to classify
+static size_t modulus_class(mpz_t modulus) {
+    uint64_t bits = mpz_sizeinbase(modulus, 2);
+    size_t m = 0;
+    while (m < MODULI - 1 && bits > modulus_bits[m]) {
+        m++;
+    }
+    return m;
+}
+
+// Finds the tuning file: $RSA_TUNE if set, else ~/.rsa_tune. Returns false when there is
+// nowhere to keep the results, in which case they only last for this process.
+//
+// path: the buffer for the path
+// size: the size of the buffer
+static bool tune_path(char *path, size_t size) {
+    char *env = getenv("RSA_TUNE"), *home = getenv("HOME");
+    if (env) {
+        return *env != '\0' && (size_t) snprintf(path, size, "%s", env) < size;
+    }
+    return home && (size_t) snprintf(path, size, "%s/.rsa_tune", home) < size;
+}
+
+// Reads the tuning file into the choice table, skipping lines it does not understand.
+static void load_choices(void) {
+    char path[4096];
+    FILE *file = tune_path(path, sizeof(path)) ? fopen(path, "r") : NULL;
+    if (!file) {
+        return;
+    }
+    char kind[16], exponent[16], backend[16];
+    uint64_t bits;
+    while (fscanf(file, "%15s %lu %15s %15s", kind, &bits, exponent, backend) == 4) {
+        int k = 0, x = 0, b = 0;
+        size_t m = 0;
+        while (k < KINDS && strcmp(kind, kind_names[k])) {
+            k++;
+        }
+        while (x < EXPONENTS && strcmp(exponent, exponent_names[x])) {
+            x++;
+        }
+        while (b < BACKENDS && strcmp(backend, backend_names[b])) {
+            b++;
+        }
+        while (m < MODULI && bits != modulus_bits[m]) {
+            m++;
+        }
+        if (k < KINDS && x < EXPONENTS && b < BACKENDS && m < MODULI && (k == PUBLIC || constant_time[b])) {
+            atomic_store(&chosen[k][x][m], b);
+        }
+    }
+    fclose(file);
+}
+
+// Writes every tuned class to the tuning file, replacing it by rename so that a process
+// reading it never sees half a table.
+static bool save_choices(void) {
+    char path[4096], temp[4112];
+    if (!tune_path(path, sizeof(path))) {
+        return false;
+    }
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int) getpid());
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+    if (!file) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    bool ok = true;
+    for (int k = 0; k < KINDS; k++) {
+        for (int x = 0; x < EXPONENTS; x++) {
+            for (size_t m = 0; m < MODULI; m++) {
+                int b = atomic_load(&chosen[k][x][m]);
+                if (b != UNTUNED) {
+                    const char *name = backend_names[b];
+                    ok = fprintf(file, "%s %lu %s %s\n", kind_names[k], modulus_bits[m], exponent_names[x], name) > 0 && ok;
+                }
+            }
+        }
+    }
+    ok = !fflush(file) && !fsync(fd) && ok;
+    ok = !fclose(file) && ok && !rename(temp, path);
+    if (!ok) {
+        unlink(temp);
+    }
+    return ok;
+}
+
+// Returns the time in nanoseconds from an arbitrary start.
+static uint64_t now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// Times every backend allowed for a size class and records the fastest. The operands come
+// from a private generator so tuning never draws from the key generation streams. A backend
+// whose result disagrees with the plain square and multiply is never picked.
+//
+// k: the kind of operation
+// x: the exponent class
+// m: the modulus class
+// verbose: whether to print the timings
+static void calibrate(int k, int x, size_t m, bool verbose) {
+    gmp_randstate_t state;
+    gmp_randinit_default(state);
+    gmp_randseed_ui(state, TUNE_SEED + k * 100 + x * 10 + m);
+    mpz_t base, exponent, modulus, expect, out;
+    mpz_inits(base, exponent, modulus, expect, out, NULL);
+    uint64_t bits = modulus_bits[m];
+    mpz_urandomb(modulus, state, bits);
+    mpz_setbit(modulus, bits - 1);
+    mpz_setbit(modulus, 0); // RSA moduli are odd
+    mpz_urandomm(base, state, modulus);
+    mpz_urandomb(exponent, state, x == SHORT ? SHORT_BITS : bits);
+    mpz_setbit(exponent, (x == SHORT ? SHORT_BITS : bits) - 1);
+    pow_mod_binary(expect, base, exponent, modulus);
+
+    int best = UNTUNED;
+    uint64_t best_time = UINT64_MAX;
+    for (int b = 0; b < BACKENDS; b++) {
+        if (k == SECRET && !constant_time[b]) {
+            continue;
+        }
+        uint64_t fastest = UINT64_MAX, start = now();
+        for (int rep = 0; rep < TUNE_REPS && (rep == 0 || now() - start < TUNE_NSEC); rep++) {
+            uint64_t begin = now();
+            backends[b](out, base, exponent, modulus);
+            uint64_t spent = now() - begin;
+            fastest = spent < fastest ? spent : fastest;
+        }
+        bool agrees = mpz_cmp(out, expect) == 0;
+        if (verbose) {
+            fprintf(stdout, "%-6s %5lu %-5s %-8s %10.3f ms%s\n", kind_names[k], bits, exponent_names[x],
+                backend_names[b], fastest / 1e6, agrees ? "" : " (wrong result)");
+        }
+        if (agrees && fastest < best_time) {
+            best = b;
+            best_time = fastest;
+        }
+    }
+    atomic_store(&chosen[k][x][m], best == UNTUNED ? (k == SECRET ? WINDOW : BINARY) : best);
+    mpz_clears(base, exponent, modulus, expect, out, NULL);
+    gmp_randclear(state);
+}
+
+// Picks the exponentiation backend for an operation from the tuning file, which is read
+// the first time a backend is needed. Size classes missing from it use the default for
+// their kind; nothing is timed or written unless tune_calibrate is called.
+//
+// exponent: the exponent of the operation
+// modulus : the modulus of the operation
+// secret  : whether the exponent is secret, which limits the choice to constant time backends
+PowMod tune_select(mpz_t exponent, mpz_t modulus, bool secret) {
+    int k = secret ? SECRET : PUBLIC, x = mpz_sizeinbase(exponent, 2) <= SHORT_BITS ? SHORT : FULL;
+    size_t m = modulus_class(modulus);
+    if (!atomic_load(&ready)) {
+        pthread_mutex_lock(&lock);
+        if (!loaded) {
+            reset_choices();
+            load_choices();
+            loaded = true;
+            atomic_store(&ready, true);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+    int b = atomic_load(&chosen[k][x][m]);
+    return backends[b == UNTUNED ? defaults[k] : b];
+}
+
+// Times every backend for every size class and rewrites the tuning file with the results.
+//
+// verbose: whether to print the timings and choices
+bool tune_calibrate(bool verbose) {
+    pthread_mutex_lock(&lock);
+    reset_choices();
+    loaded = true;
+    atomic_store(&ready, true);
+    for (int k = 0; k < KINDS; k++) {
+        for (int x = 0; x < EXPONENTS; x++) {
+            for (size_t m = 0; m < MODULI; m++) {
+                calibrate(k, x, m, verbose);
+            }
+        }
+    }
+    bool saved = save_choices();
+    pthread_mutex_unlock(&lock);
+    return saved;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+#include <gmp.h>
+
+typedef void (*PowMod)(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
+
+PowMod tune_select(mpz_t exponent, mpz_t modulus, bool secret);
+
+bool tune_calibrate(bool verbose);
@@ -0,0 +1,82 @@
+#include "vcache.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LINE_BYTES (SHA256_BYTES * 2 + 1)
+
+// Formats a fingerprint as a lowercase hex string.
+//
+// hex: the 64 character string plus terminator
+// fp : the fingerprint
+static void to_hex(char hex[LINE_BYTES], uint8_t fp[SHA256_BYTES]) {
+    for (int i = 0; i < SHA256_BYTES; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", fp[i]);
+    }
+}
+
+// Opens the cache, refusing files that others could write to since any entry in the
+// cache lets a public key skip its signature check.
+//
+// path : the cache file
+// flags: the open flags
+static FILE *open_cache(char *path, int flags) {
+    int fd = open(path, flags, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) || info.st_uid != geteuid() || (info.st_mode & (S_IWGRP | S_IWOTH))) {
+        fprintf(stderr, "Ignoring unsafe verification cache %s.\n", path);
+        close(fd);
+        return NULL;
+    }
+    FILE *cache = fdopen(fd, flags & O_APPEND ? "a" : "r");
+    if (!cache) {
+        close(fd);
+    }
+    return cache;
+}
+
+// Checks whether a key fingerprint was previously recorded as verified.
+//
+// path: the cache file
+// fp  : the fingerprint of the public key
+bool vcache_contains(char *path, uint8_t fp[SHA256_BYTES]) {
+    FILE *cache = open_cache(path, O_RDONLY);
+    if (!cache) {
+        return false;
+    }
+    char want[LINE_BYTES], line[LINE_BYTES + 1];
+    to_hex(want, fp);
+    bool found = false;
+    flock(fileno(cache), LOCK_SH);
+    while (!found && fgets(line, sizeof(line), cache)) {
+        found = strncmp(line, want, LINE_BYTES - 1) == 0 && line[LINE_BYTES - 1] == '\n';
+    }
+    flock(fileno(cache), LOCK_UN);
+    fclose(cache);
+    return found;
+}
+
+// Records a key fingerprint as verified, creating the cache if needed.
+// Returns false if the cache could not be written.
+//
+// path: the cache file
+// fp  : the fingerprint of the public key
+bool vcache_record(char *path, uint8_t fp[SHA256_BYTES]) {
+    FILE *cache = open_cache(path, O_WRONLY | O_CREAT | O_APPEND);
+    if (!cache) {
+        return false;
+    }
+    char hex[LINE_BYTES];
+    to_hex(hex, fp);
+    flock(fileno(cache), LOCK_EX);
+    bool written = fprintf(cache, "%s\n", hex) == LINE_BYTES && fflush(cache) == 0;
+    flock(fileno(cache), LOCK_UN);
+    fclose(cache);
+    return written;
+}
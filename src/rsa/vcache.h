@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sha256.h"
+
+bool vcache_contains(char *path, uint8_t fp[SHA256_BYTES]);
+
+bool vcache_record(char *path, uint8_t fp[SHA256_BYTES]);
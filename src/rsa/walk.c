@@ -0,0 +1,58 @@
+#include "walk.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Walks one directory of the tree.
+//
+// dir : the directory to scan
+// skip: the length of the tree's root plus its slash, cut off to make relative paths
+// fn  : the function called for every regular file
+// arg : the argument passed to fn
+static bool walk(char *dir, size_t skip, WalkFn fn, void *arg) {
+    DIR *directory = opendir(dir);
+    if (!directory) {
+        fprintf(stderr, "Unable to open directory %s.\n", dir);
+        return false;
+    }
+    bool ok = true;
+    struct dirent *entry;
+    while (ok && (entry = readdir(directory))) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+            continue;
+        }
+        size_t path_len = strlen(dir) + strlen(entry->d_name) + 2;
+        char *path = (char *) malloc(path_len);
+        struct stat info;
+        if (!path) {
+            ok = false;
+        } else {
+            snprintf(path, path_len, "%s/%s", dir, entry->d_name);
+            // Links are only followed to files, so a link back up the tree cannot loop
+            bool linked = !lstat(path, &info) && S_ISLNK(info.st_mode);
+            if ((linked && stat(path, &info)) || (!linked && lstat(path, &info))) {
+                fprintf(stderr, "Unable to stat %s.\n", path);
+            } else if (S_ISDIR(info.st_mode) && !linked) {
+                ok = walk(path, skip, fn, arg);
+            } else if (S_ISREG(info.st_mode)) {
+                ok = fn(path, path + skip, arg);
+            }
+        }
+        free(path);
+    }
+    closedir(directory);
+    return ok;
+}
+
+// Calls fn on every regular file under dir, including files reached through symbolic
+// links. Linked directories are skipped, so every file is visited once even when links
+// point back up the tree. Stops and returns false as soon as fn does.
+//
+// dir: the root of the tree
+// fn : the function called with each file's path and its path relative to dir
+// arg: the argument passed to fn
+bool walk_tree(char *dir, WalkFn fn, void *arg) {
+    return walk(dir, strlen(dir) + 1, fn, arg);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdbool.h>
+
+typedef bool (*WalkFn)(char *path, char *relative, void *arg);
+
+bool walk_tree(char *dir, WalkFn fn, void *arg);
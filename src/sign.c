@@ -0,0 +1,156 @@
+#include "numtheory.h"
+#include "rsa.h"
+#include "keyring.h"
+#include <unistd.h>
+#include <stdlib.h>
+
+#define OPTIONS "i:o:n:vh"
+#define VERBOSE true
+
+enum Files { INFILE, OUTFILE, PVFILE };
+
+void help_message(char *error, FILE **files);
+void close_files(FILE **files);
+bool check_optarg(char *optarg, FILE **files);
+
+
+int main(int argc, char **argv) {
+    int8_t opt = 0;
+    bool verbose = false;
+    char *ring = NULL, *ringname = NULL;
+    FILE *files[3] = { stdin, stdout, NULL };
+    // Checks all flags
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'v': verbose = VERBOSE; break; // Stats
+        case 'i': // Input
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            files[INFILE] = fopen(optarg, "r");
+            if (!files[INFILE]) {
+                help_message("Invalid file.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'o': // Signature
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            files[OUTFILE] = fopen(optarg, "w");
+            if (!files[OUTFILE]) {
+                help_message("Invalid file.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n': // Private file
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            files[PVFILE] = fopen(optarg, "r");
+            if (!files[PVFILE] && !keyring_reference(optarg, &ring, &ringname)) {
+                help_message("Invalid file.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h': help_message("", files); return EXIT_SUCCESS;
+        default: help_message("Invalid flag.\n", files); return EXIT_FAILURE;
+        }
+    }
+
+    if (!files[PVFILE] && !ring) {
+        files[PVFILE] = fopen("rsa.priv", "r");
+    }
+    if (!files[PVFILE] && !ring) {
+        help_message("Unable to open rsa.priv\n", files);
+        return EXIT_FAILURE;
+    }
+
+    mpz_t secret, mod, signature;
+    mpz_inits(secret, mod, signature, NULL);
+    if (!ring) {
+        rsa_read_priv(mod, secret, files[PVFILE]); // Read private key and public modulus
+    } else if (!keyring_read(ring, ringname, mod, NULL, NULL, secret, NULL)) {
+        mpz_clears(secret, mod, signature, NULL);
+        close_files(files);
+        return EXIT_FAILURE;
+    }
+    if (verbose) { // Verbose output
+        gmp_fprintf(stdout, "n (%d bits) = %Zd\n", mpz_sizeinbase(mod, 2), mod);
+        gmp_fprintf(stdout, "d (%d bits) = %Zd\n", mpz_sizeinbase(secret, 2), secret);
+    }
+
+    if (mpz_sizeinbase(mod, 2) < SIGN_FILE_BITS) {
+        fprintf(stderr, "Keys need at least %d bits to sign files.\n", SIGN_FILE_BITS);
+        mpz_clears(secret, mod, signature, NULL);
+        close_files(files);
+        return EXIT_FAILURE;
+    }
+    if (!rsa_sign_file(signature, files[INFILE], secret, mod)) {
+        fprintf(stderr, "Unable to sign the input.\n");
+        mpz_clears(secret, mod, signature, NULL);
+        close_files(files);
+        return EXIT_FAILURE;
+    }
+    gmp_fprintf(files[OUTFILE], "%Zx\n", signature); // Detached signature
+    close_files(files);
+    mpz_clears(secret, mod, signature, NULL);
+    return EXIT_SUCCESS;
+}
+
+//
+// Closes file pointers.
+//
+// files: an array of file pointers
+//
+void close_files(FILE **files) {
+    if (files[PVFILE]) {
+        fclose(files[PVFILE]);
+    }
+    if (files[INFILE] && files[INFILE] != stdin) {
+        fclose(files[INFILE]);
+    }
+    if (files[OUTFILE] && files[OUTFILE] != stdout) {
+        fclose(files[OUTFILE]);
+    }
+    return;
+}
+
+//
+// Ensures a flag that needs an argument has an argument.
+//
+// optarg: the argument given to the specific flag
+// files: an array of file pointers
+//
+bool check_optarg(char *optarg, FILE **files) {
+    if (!optarg) {
+        help_message("", files);
+        return false;
+    }
+    return true;
+}
+
+//
+// Prints out the help message that describes how to use the program and prints an error if specified.
+//
+// error: the error to print
+// files: an array of file pointers
+//
+void help_message(char *error, FILE **files) {
+    if (*error != '\0') {
+        fprintf(stderr, "%s", error);
+    }
+    close_files(files);
+    fprintf(stderr, "SYNOPSIS\n"
+                    "  Creates a detached RSA signature of a file's SHA-256 digest.\n"
+                    "  Signatures are checked by the verify program.\n\n"
+                    "USAGE\n"
+                    "  ./sign [-hv] [-i infile] [-o sigfile] [-n privkey]\n\n"
+                    "OPTIONS\n"
+                    "  -h              Display program help and usage.\n"
+                    "  -v              Display verbose program output.\n"
+                    "  -i infile       Input file to sign (default: stdin).\n"
+                    "  -o sigfile      Output file for the signature (default: stdout).\n"
+                    "  -n pvfile       Private key file or keyring:user (default: rsa.priv).\n");
+    return;
+}
@@ -0,0 +1,159 @@
+#include "numtheory.h"
+#include "rsa.h"
+#include "keyring.h"
+#include <unistd.h>
+#include <stdlib.h>
+
+#define OPTIONS "i:s:n:vh"
+#define VERBOSE true
+
+enum Files { INFILE, SIGFILE, PBFILE };
+
+void help_message(char *error, FILE **files);
+void close_files(FILE **files);
+bool check_optarg(char *optarg, FILE **files);
+
+
+int main(int argc, char **argv) {
+    int8_t opt = 0;
+    bool verbose = false;
+    char *ring = NULL, *ringname = NULL;
+    FILE *files[3] = { stdin, NULL, NULL };
+    // Checks all flags
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'v': verbose = VERBOSE; break; // Stats
+        case 'i': // Input
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            files[INFILE] = fopen(optarg, "r");
+            if (!files[INFILE]) {
+                help_message("Invalid file.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's': // Signature
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            files[SIGFILE] = fopen(optarg, "r");
+            if (!files[SIGFILE]) {
+                help_message("Invalid file.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n': // Public key
+            if (!check_optarg(optarg, files)) {
+                return EXIT_FAILURE;
+            }
+            files[PBFILE] = fopen(optarg, "r");
+            if (!files[PBFILE] && !keyring_reference(optarg, &ring, &ringname)) {
+                help_message("Invalid file.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h': help_message("", files); return EXIT_SUCCESS;
+        default: help_message("Invalid flag.\n", files); return EXIT_FAILURE;
+        }
+    }
+
+    if (!files[SIGFILE]) {
+        help_message("A signature file is required.\n", files);
+        return EXIT_FAILURE;
+    }
+    if (!files[PBFILE] && !ring) {
+        files[PBFILE] = fopen("rsa.pub", "r");
+    }
+    if (!files[PBFILE] && !ring) {
+        help_message("Unable to open rsa.pub\n", files);
+        return EXIT_FAILURE;
+    }
+
+    char user[USER_MAX];
+    mpz_t sign, exponent, mod, name, signature;
+    mpz_inits(sign, exponent, mod, name, signature, NULL);
+    if (!ring) {
+        rsa_read_pub(mod, exponent, sign, user,
+            files[PBFILE]); // Reads in public key, exponent, and user signature/username
+    } else if (!keyring_read(ring, ringname, mod, exponent, sign, NULL, user)) {
+        mpz_clears(sign, exponent, mod, name, signature, NULL);
+        close_files(files);
+        return EXIT_FAILURE;
+    }
+    if (verbose) { // Verbose output
+        gmp_fprintf(stdout, "User = %s\n", user);
+        gmp_fprintf(stdout, "n (%d bits) = %Zd\n", mpz_sizeinbase(mod, 2), mod);
+        gmp_fprintf(stdout, "e (%d bits) = %Zd\n", mpz_sizeinbase(exponent, 2), exponent);
+    }
+
+    if (mpz_sizeinbase(mod, 2) < SIGN_FILE_BITS) {
+        fprintf(stderr, "Keys need at least %d bits to sign files.\n", SIGN_FILE_BITS);
+        close_files(files);
+        mpz_clears(sign, exponent, mod, name, signature, NULL);
+        return EXIT_FAILURE;
+    }
+    bool valid = gmp_fscanf(files[SIGFILE], "%Zx", signature) == 1;
+    valid = valid && !mpz_set_str(name, user, 62) && rsa_verify(name, sign, exponent, mod);
+    valid = valid && rsa_verify_file(files[INFILE], signature, exponent, mod);
+    fprintf(valid ? stdout : stderr, valid ? "Signature OK for %s\n" : "Invalid signature!\n", user);
+    close_files(files);
+    mpz_clears(sign, exponent, mod, name, signature, NULL);
+    return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//
+// Closes file pointers.
+//
+// files: an array of file pointers
+//
+void close_files(FILE **files) {
+    if (files[PBFILE]) {
+        fclose(files[PBFILE]);
+    }
+    if (files[SIGFILE]) {
+        fclose(files[SIGFILE]);
+    }
+    if (files[INFILE] && files[INFILE] != stdin) {
+        fclose(files[INFILE]);
+    }
+    return;
+}
+
+//
+// Ensures a flag that needs an argument has an argument.
+//
+// optarg: the argument for the specified flag
+// files: an array of file pointers
+//
+bool check_optarg(char *optarg, FILE **files) {
+    if (!optarg) {
+        help_message("", files);
+        return false;
+    }
+    return true;
+}
+
+//
+// Prints out the help message that describes how to use the program and prints an error if specified.
+//
+// error: an error to print
+// files: an array of file pointers
+//
+void help_message(char *error, FILE **files) {
+    if (*error != '\0') {
+        fprintf(stderr, "%s", error);
+    }
+    close_files(files);
+    fprintf(stderr, "SYNOPSIS\n"
+                    "  Verifies a detached RSA signature made by the sign program.\n\n"
+                    "USAGE\n"
+                    "  ./verify [-hv] [-i infile] [-n pubkey] -s sigfile\n\n"
+                    "OPTIONS\n"
+                    "  -h              Display program help and usage.\n"
+                    "  -v              Display verbose program output.\n"
+                    "  -i infile       Input file that was signed (default: stdin).\n"
+                    "  -s sigfile      Detached signature of the input file.\n"
+                    "  -n pbfile       Public key file or keyring:user (default: rsa.pub).\n");
+    return;
+}
@@ -0,0 +1,76 @@
+#include "rsa.h"
+#include "randstate.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BITS   512
+#define ITERS  25
+#define SEED   2022
+#define TRIALS 64 // Each pair of forgeries gets fresh weights
+
+//
+// Makes a key whose modulus is mod (4) and signs two random messages with it.
+//
+// mod: the wanted n mod 4
+// n: the public product
+// e: the public exponent
+// m: the two messages
+// s: the two signatures
+//
+static void make_signed(uint64_t mod, mpz_t n, mpz_t e, mpz_ptr m[2], mpz_ptr s[2]) {
+    mpz_t p, q, d;
+    mpz_inits(p, q, d, NULL);
+    do {
+        rsa_make_pub(p, q, n, e, BITS, ITERS);
+    } while (mpz_fdiv_ui(n, 4) != mod);
+    rsa_make_priv(d, e, p, q);
+    for (int i = 0; i < 2; i++) {
+        randstate_urandomm(m[i], n);
+        rsa_sign(s[i], m[i], d, n);
+    }
+    mpz_clears(p, q, d, NULL);
+    return;
+}
+
+//
+// Prints the outcome of a check and returns whether it passed.
+//
+// name: what was checked
+// passed: whether it passed
+//
+static bool report(char *name, bool passed) {
+    printf("%s: %s\n", passed ? "PASS" : "FAIL", name);
+    return passed;
+}
+
+int main(void) {
+    randstate_init(SEED);
+    mpz_t n, e, m0, m1, s0, s1;
+    mpz_inits(n, e, m0, m1, s0, s1, NULL);
+    mpz_ptr m[2] = { m0, m1 }, s[2] = { s0, s1 };
+    bool ok = true;
+
+    make_signed(3, n, e, m, s);
+    ok &= report("valid signatures pass together", rsa_verify_batch(m, s, 2, e, n));
+
+    mpz_sub(s0, n, s0), mpz_sub(s1, n, s1); // Both signatures off by a factor of -1
+    bool caught = true;
+    for (int i = 0; i < TRIALS; i++) {
+        caught = caught && !rsa_verify_batch(m, s, 2, e, n);
+    }
+    ok &= report("two negated signatures fail together", caught);
+    ok &= report("each negated signature fails alone", !rsa_verify(m0, s0, e, n) && !rsa_verify(m1, s1, e, n));
+
+    mpz_sub(s1, n, s1); // Only the first is still negated
+    ok &= report("one negated signature fails together", !rsa_verify_batch(m, s, 2, e, n));
+
+    make_signed(1, n, e, m, s);
+    mpz_sub(s0, n, s0), mpz_sub(s1, n, s1);
+    ok &= report("negation is not tested together when n = 1 mod 4", !rsa_verify_batch(m, s, 2, e, n));
+    ok &= report("each negated signature fails alone when n = 1 mod 4",
+        !rsa_verify(m0, s0, e, n) && !rsa_verify(m1, s1, e, n));
+
+    mpz_clears(n, e, m0, m1, s0, s1, NULL);
+    randstate_clear();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}